@@ -0,0 +1,72 @@
+#ifndef __COUNTING_H__
+#define __COUNTING_H__
+
+#include "firmata.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Replaces the global allocator to count heap allocations, for benchmarks
+ * that fail if a path allocates. Defines the replacement operators, so
+ * include it from exactly one source file per executable.
+ */
+
+static std::atomic<size_t> allocations(0);
+
+// Every form goes straight to malloc and free, so each new is paired with a matching delete
+static void* countedMalloc(size_t size)
+{
+	allocations++;
+	void* p = malloc(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size)
+{
+	return countedMalloc(size);
+}
+
+void* operator new[](size_t size)
+{
+	return countedMalloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// Counts strings instead of printing them, which would allocate
+class QuietFirmata : public firmata::Firmata<firmata::Base, firmata::I2C> {
+public:
+	QuietFirmata(firmata::FirmIO* firmIO) : firmata::Base(firmIO), firmata::I2C(firmIO), firmata::Firmata<firmata::Base, firmata::I2C>(firmIO), strings(0) {};
+
+	size_t strings;
+
+protected:
+	virtual bool handleString(firmata::StringView data) override
+	{
+		strings += data.size() > 0;
+		return true;
+	}
+};
+
+#endif // !__COUNTING_H__
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "counting.h"
+#include "firmata.h"
+#include "simboard.h"
+
+/*
+ * Feed a steady mix of analog, digital, I2C reply and string messages through
+ * Firmata<Base, I2C> and count heap allocations on the receive path, then
+ * do the same for a mix of outgoing commands.
+ * Fails if steady-state parsing or sending allocates at all.
+ */
+
+int main(int argc, const char* argv[])
+{
+	size_t passes = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+	SimulatedBoard* board = new SimulatedBoard();
+	QuietFirmata* f = new QuietFirmata(board);
+	if (!f->ready()) {
+		std::cout << "Simulated board did not complete the handshake" << std::endl;
+		return 1;
+	}
+
+	uint8_t i2c_bytes[] = { 1, 2, 3, 4, 5, 6 };
+	std::vector<uint8_t> messages;
+	size_t messages_per_pass = 0;
+	for (uint8_t channel = 0; channel < 6; channel++, messages_per_pass++) {
+		SimulatedBoard::analogMessage(messages, channel, 512 + channel);
+	}
+	SimulatedBoard::digitalMessage(messages, 0, 0x55); messages_per_pass++;
+	SimulatedBoard::i2cReply(messages, 8, 0, i2c_bytes, sizeof(i2c_bytes)); messages_per_pass++;
+	SimulatedBoard::stringMessage(messages, "steady state"); messages_per_pass++;
+
+	// Let buffers reach their steady-state capacity first
+	for (int i = 0; i < 100; i++) {
+		board->feed(messages);
+		f->parse();
+	}
+
+	size_t before = allocations;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < passes; i++) {
+		board->feed(messages);
+		f->parse();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	size_t allocated = allocations - before;
+
+	size_t total = passes * messages_per_pass;
+	std::cout << "messages:       " << total << std::endl;
+	std::cout << "strings seen:   " << f->strings << std::endl;
+	std::cout << "allocations:    " << allocated << std::endl;
+	std::cout << "allocs/message: " << (double)allocated / total << std::endl;
+	std::cout << "ns/message:     " << elapsed.count() / total << std::endl;
+
+	uint8_t i2c_write[] = { 0x10, 0x20 };
+	for (int i = 0; i < 100; i++) {
+		f->writeI2C(8, i2c_write, sizeof(i2c_write));
+	}
+
+	size_t commands = passes * 5;
+	size_t before_send = allocations;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < passes; i++) {
+		f->pinMode(13, MODE_OUTPUT);
+		f->digitalWrite(13, i & 1);
+		f->analogWrite(3, i & FIRMATA_MAX);
+		f->setSamplingInterval(19);
+		f->writeI2C(8, i2c_write, sizeof(i2c_write));
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+	size_t send_allocated = allocations - before_send;
+
+	std::cout << "commands:       " << commands << std::endl;
+	std::cout << "send allocs:    " << send_allocated << std::endl;
+	std::cout << "ns/command:     " << elapsed.count() / commands << std::endl;
+
+	return allocated == 0 && send_allocated == 0 ? 0 : 1;
+}
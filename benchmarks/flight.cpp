@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "counting.h"
+#include "firmata.h"
+#include "simboard.h"
+
+/*
+ * Cost of the always-on flight recorder. Parses the dispatch benchmark's
+ * message mix, then repeats just the recording parse() does for it on a
+ * standalone recorder to show its share of the time, and what that costs on
+ * a saturated serial link. Also times recording
+ * from several threads at once and snapshotting a full ring.
+ * Fails if parsing or recording allocates at all.
+ */
+
+int main(int argc, const char* argv[])
+{
+	size_t passes = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+	SimulatedBoard* board = new SimulatedBoard();
+	QuietFirmata* f = new QuietFirmata(board);
+	if (!f->ready()) {
+		std::cout << "Simulated board did not complete the handshake" << std::endl;
+		return 1;
+	}
+
+	uint8_t i2c_bytes[] = { 1, 2, 3, 4, 5, 6 };
+	std::vector<uint8_t> messages;
+	size_t messages_per_pass = 0;
+	for (uint8_t channel = 0; channel < 6; channel++, messages_per_pass++) {
+		SimulatedBoard::analogMessage(messages, channel, 512 + channel);
+	}
+	SimulatedBoard::digitalMessage(messages, 0, 0x55); messages_per_pass++;
+	SimulatedBoard::i2cReply(messages, 8, 0, i2c_bytes, sizeof(i2c_bytes)); messages_per_pass++;
+	SimulatedBoard::stringMessage(messages, "steady state"); messages_per_pass++;
+
+	for (int i = 0; i < 100; i++) {
+		board->feed(messages);
+		f->parse();
+	}
+
+	size_t before = allocations;
+	uint64_t recorded = f->flightRecorder().recorded();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < passes; i++) {
+		board->feed(messages);
+		f->parse();
+	}
+	std::chrono::duration<double, std::nano> parsing = std::chrono::steady_clock::now() - start;
+	size_t parse_allocated = allocations - before;
+	recorded = f->flightRecorder().recorded() - recorded;
+
+	// What parse() records for each pass: the bytes read, then one header per message
+	firmata::FlightRecorder recorder;
+	std::vector<uint8_t> headers(messages_per_pass * 8, 0x55);
+	before = allocations;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < passes; i++) {
+		recorder.record(firmata::FLIGHT_RX, i, messages.data(), messages.size());
+		for (size_t offset = 0; offset < headers.size(); offset += FIRMATA_FLIGHT_SLOT_BYTES) {
+			size_t size = headers.size() - offset < FIRMATA_FLIGHT_SLOT_BYTES ? headers.size() - offset : FIRMATA_FLIGHT_SLOT_BYTES;
+			recorder.record(firmata::FLIGHT_MESSAGES, i, headers.data() + offset, size);
+		}
+	}
+	std::chrono::duration<double, std::nano> recording = std::chrono::steady_clock::now() - start;
+	size_t record_allocated = allocations - before;
+
+	size_t total = passes * messages_per_pass;
+	std::cout << "messages:         " << total << std::endl;
+	std::cout << "slots/pass:       " << (double)recorded / passes << std::endl;
+	std::cout << "parse ns/message: " << parsing.count() / total << std::endl;
+	std::cout << "flight ns/msg:    " << recording.count() / total << std::endl;
+	std::cout << "flight share:     " << 100 * recording.count() / parsing.count() << "%" << std::endl;
+	std::cout << "allocations:      " << parse_allocated + record_allocated << std::endl;
+
+	// A saturated 115200 baud link carries 11520 bytes a second
+	double link_messages = 11520.0 * messages_per_pass / messages.size();
+	std::cout << "115200 baud load: " << 100 * link_messages * recording.count() / total / 1e9 << "% of a core recording" << std::endl;
+
+	// Sending threads record writes into the same ring as the parse thread
+	const int threads = 4;
+	const size_t records = passes * 10;
+	uint8_t command[] = { 0xE3, 0x7F, 0x03 };
+	std::vector<std::thread> writers;
+	start = std::chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++) {
+		writers.push_back(std::thread([&recorder, &command, records] {
+			for (size_t i = 0; i < records; i++) {
+				recorder.record(firmata::FLIGHT_TX, i, command, sizeof(command));
+			}
+		}));
+	}
+	for (auto& writer : writers) writer.join();
+	std::chrono::duration<double, std::nano> contended = std::chrono::steady_clock::now() - start;
+	std::cout << "threads:          " << threads << std::endl;
+	std::cout << "ns/record:        " << contended.count() / records << " (wall, per thread)" << std::endl;
+
+	start = std::chrono::steady_clock::now();
+	size_t entries = recorder.entries().size();
+	std::chrono::duration<double, std::micro> snapshot = std::chrono::steady_clock::now() - start;
+	std::cout << "snapshot:         " << entries << " entries in " << snapshot.count() << " us" << std::endl;
+
+	delete f;
+	return parse_allocated == 0 && record_allocated == 0 ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <cstring>
+#include <stdint.h>
+
+/*
+ * Fixed-size log-linear histogram of latencies, in whatever unit the caller
+ * records. Values under 256 are exact; above that each power of two is split
+ * into 128 buckets, so percentiles are within 1%. Recording never allocates.
+ */
+class LatencyHistogram {
+public:
+	LatencyHistogram() { reset(); }
+
+	void reset()
+	{
+		memset(m_buckets, 0, sizeof(m_buckets));
+		m_count = 0;
+		m_max = 0;
+		m_total = 0;
+	}
+
+	void record(uint64_t us)
+	{
+		m_buckets[bucket(us)]++;
+		m_count++;
+		m_total += us;
+		if (us > m_max) m_max = us;
+	}
+
+	uint64_t count() const { return m_count; }
+	uint64_t max() const { return m_max; }
+	double mean() const { return m_count ? (double)m_total / m_count : 0; }
+
+	// Lowest value of the bucket holding the p-th percentile, p in [0, 100]
+	uint64_t percentile(double p) const
+	{
+		if (!m_count) return 0;
+		uint64_t rank = (uint64_t)(p / 100 * m_count);
+		if (rank >= m_count) rank = m_count - 1;
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; i++) {
+			seen += m_buckets[i];
+			if (seen > rank) return lowest(i);
+		}
+		return m_max;
+	}
+
+private:
+	static const size_t EXACT = 256;
+	static const int SUB_BITS = 7;
+	static const size_t BUCKETS = EXACT + (64 - 8) * (1 << SUB_BITS);
+
+	static size_t bucket(uint64_t us)
+	{
+		if (us < EXACT) return (size_t)us;
+
+		int exponent = 8;
+		while (exponent < 63 && us >> (exponent + 1)) exponent++;
+		size_t sub = (size_t)(us >> (exponent - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+		return EXACT + (exponent - 8) * (1 << SUB_BITS) + sub;
+	}
+
+	static uint64_t lowest(size_t index)
+	{
+		if (index < EXACT) return index;
+
+		int exponent = (int)((index - EXACT) >> SUB_BITS) + 8;
+		uint64_t sub = (index - EXACT) & ((1 << SUB_BITS) - 1);
+		return ((uint64_t)1 << exponent) | (sub << (exponent - SUB_BITS));
+	}
+
+	uint64_t m_buckets[BUCKETS];
+	uint64_t m_count;
+	uint64_t m_max;
+	uint64_t m_total;
+};
+
+#endif // !__LATENCY_H__
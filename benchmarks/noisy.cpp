@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "firmata.h"
+#include "simboard.h"
+
+/*
+ * Feed a stream of analog messages with glitches injected at a given rate
+ * (flipped bits, dropped bytes, inserted noise, stray START_SYSEX) and count
+ * how many of the untouched messages still arrive. Each message carries its
+ * own sequence number as the value, so anything lost around a glitch shows
+ * up as collateral loss. Fails if a glitch costs any message but its own.
+ *
+ *   noisy_benchmark [glitches per 1000 messages] [rounds of 98304 messages]
+ */
+
+class SequenceListener : public firmata::SampleListener {
+public:
+	SequenceListener() : received(6 * (FIRMATA_MAX + 1), false) {};
+
+	std::vector<bool> received;
+
+	virtual void onSample(uint8_t pin, uint32_t value, uint64_t timestamp) override
+	{
+		(void)timestamp;
+		size_t index = value * 6 + (pin - 14);
+		if (index < received.size()) received[index] = true;
+	}
+};
+
+int main(int argc, const char* argv[])
+{
+	double glitch_rate = (argc > 1 ? atof(argv[1]) : 10) / 1000.0;
+	size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 6;
+
+	SimulatedBoard* board = new SimulatedBoard();
+	firmata::Firmata<firmata::Base>* f = new firmata::Firmata<firmata::Base>(board);
+	if (!f->ready()) {
+		std::cout << "Simulated board did not complete the handshake" << std::endl;
+		return 1;
+	}
+
+	SequenceListener listener;
+	f->addSampleListener(&listener);
+
+	// Each round sends every 14-bit value once on each of the 6 analog channels
+	size_t per_round = listener.received.size();
+	size_t messages = rounds * per_round;
+	size_t glitches = 0, clean_lost = 0, bytes = 0;
+	double elapsed_ns = 0;
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> chance(0, 1);
+	std::vector<uint8_t> stream;
+	std::vector<bool> glitched(per_round);
+	stream.reserve(4 * per_round);
+
+	for (size_t round = 0; round < rounds; round++) {
+		stream.clear();
+		for (size_t i = 0; i < per_round; i++) {
+			uint8_t message[4];
+			size_t size = 3;
+			message[0] = (uint8_t)(FIRMATA_ANALOG_MESSAGE | (i % 6));
+			message[1] = (uint8_t)FIRMATA_LSB(i / 6);
+			message[2] = (uint8_t)FIRMATA_MSB(i / 6);
+
+			glitched[i] = chance(random) < glitch_rate;
+			if (glitched[i]) {
+				size_t at = random() % 3;
+				switch (random() % 4) {
+				case 0:
+					message[at] ^= 1 << (random() % 8);
+					break;
+				case 1:
+					for (size_t j = at; j < 2; j++) message[j] = message[j + 1];
+					size = 2;
+					break;
+				default:
+					// Random noise, or a stray START_SYSEX, after the status byte
+					for (size_t j = 3; j > at + 1; j--) message[j] = message[j - 1];
+					message[at + 1] = random() % 2 ? (uint8_t)random() : FIRMATA_START_SYSEX;
+					size = 4;
+					break;
+				}
+			}
+			stream.insert(stream.end(), message, message + size);
+		}
+
+		// Hand the stream over in read-sized chunks so glitches also land across reads
+		listener.received.assign(per_round, false);
+		auto start = std::chrono::steady_clock::now();
+		for (size_t offset = 0; offset < stream.size(); offset += FIRMATA_MSG_LEN) {
+			size_t size = stream.size() - offset < FIRMATA_MSG_LEN ? stream.size() - offset : FIRMATA_MSG_LEN;
+			board->feed(stream.data() + offset, size);
+			f->parse();
+		}
+		while (board->available()) f->parse();
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		elapsed_ns += elapsed.count();
+		bytes += stream.size();
+
+		for (size_t i = 0; i < per_round; i++) {
+			if (glitched[i]) glitches++;
+			else if (!listener.received[i]) clean_lost++;
+		}
+	}
+
+	std::cout << "messages:        " << messages << std::endl;
+	std::cout << "glitched:        " << glitches << std::endl;
+	std::cout << "malformed seen:  " << f->linkStats().malformed_messages << std::endl;
+	std::cout << "clean lost:      " << clean_lost << std::endl;
+	std::cout << "lost per glitch: " << (glitches ? (double)clean_lost / glitches : 0) << std::endl;
+	std::cout << "ns/byte:         " << elapsed_ns / bytes << std::endl;
+	std::cout << "MB/s:            " << bytes / (elapsed_ns / 1000.0) << std::endl;
+
+	return clean_lost == 0 ? 0 : 1;
+}
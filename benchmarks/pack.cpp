@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "firmata_constants.h"
+#include "firmpack.h"
+
+/*
+ * Compare the 7-bit pair pack/unpack kernels and the END_SYSEX scan against
+ * the byte-at-a-time push_back loops they replaced, for a range of payload sizes
+ */
+
+static volatile size_t sink;
+
+static std::vector<uint8_t> legacyEncode(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> sysex_buffer;
+	for (uint8_t byte : data) {
+		sysex_buffer.push_back(FIRMATA_LSB(byte));
+		sysex_buffer.push_back(FIRMATA_MSB(byte));
+	}
+	return sysex_buffer;
+}
+
+static std::vector<uint8_t> legacyDecode(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> reply_buffer;
+	for (size_t i = 0; i + 1 < data.size(); i = i + 2) {
+		reply_buffer.push_back(FIRMATA_COMBINE_LSB_MSB(data[i], data[i + 1]));
+	}
+	return reply_buffer;
+}
+
+static std::vector<uint8_t> legacyScan(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> sysex_buffer;
+	for (size_t i = 0; i < data.size() && data[i] != FIRMATA_END_SYSEX; i++) {
+		sysex_buffer.push_back(data[i]);
+	}
+	return sysex_buffer;
+}
+
+static std::vector<uint8_t> kernelEncode(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> out(2 * data.size());
+	firmata::encode7BitPairs(data.data(), data.size(), out.data());
+	return out;
+}
+
+static std::vector<uint8_t> kernelDecode(const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> out(data.size() / 2);
+	firmata::decode7BitPairs(data.data(), data.size(), out.data());
+	return out;
+}
+
+static std::vector<uint8_t> kernelScan(const std::vector<uint8_t>& data)
+{
+	const uint8_t* end = firmata::findEndSysex(data.data(), data.data() + data.size());
+	return std::vector<uint8_t>(data.data(), end);
+}
+
+template< typename F >
+static double nsPerByte(F f, const std::vector<uint8_t>& data, size_t iterations)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		sink = f(data).size();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (iterations * data.size());
+}
+
+static void report(const char* name, size_t size, double legacy, double kernel)
+{
+	std::cout << name << "\t" << size << "\t" << legacy << "\t" << kernel << "\t" << legacy / kernel << "x" << std::endl;
+}
+
+int main(int argc, const char* argv[])
+{
+	size_t sizes[] = { 16, 64, 256, 1024, 16384 };
+	size_t total_bytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 64 * 1024 * 1024;
+
+	std::cout << "kernel\tbytes\tlegacy ns/B\tkernel ns/B\tspeedup" << std::endl;
+
+	for (size_t size : sizes) {
+		std::vector<uint8_t> bytes(size), pairs(2 * size), sysex(size);
+		for (size_t i = 0; i < size; i++) {
+			bytes[i] = rand() & 0xFF;
+			sysex[i] = rand() & 0x7F;
+		}
+		sysex[size - 1] = FIRMATA_END_SYSEX;
+		firmata::encode7BitPairs(bytes.data(), size, pairs.data());
+
+		if (kernelEncode(bytes) != legacyEncode(bytes) || kernelDecode(pairs) != legacyDecode(pairs)
+			|| kernelScan(sysex) != legacyScan(sysex)) {
+			std::cout << "Kernel output differs from legacy loop at " << size << " bytes" << std::endl;
+			return 1;
+		}
+
+		size_t iterations = total_bytes / size + 1;
+		report("encode", size, nsPerByte(legacyEncode, bytes, iterations), nsPerByte(kernelEncode, bytes, iterations));
+		report("decode", size, nsPerByte(legacyDecode, pairs, iterations / 2 + 1), nsPerByte(kernelDecode, pairs, iterations / 2 + 1));
+		report("scan", size, nsPerByte(legacyScan, sysex, iterations), nsPerByte(kernelScan, sysex, iterations));
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "counting.h"
+#include "firmata.h"
+#include "latency.h"
+#include "simboard.h"
+
+/*
+ * Real-time mode against the simulated board. Counts the allocations a cold
+ * board makes over its first passes, with and without enterRealtime() and
+ * with no warm-up, then times every parse() call in real-time mode and
+ * reports percentiles down to p99.9, along with the voluntary context
+ * switches and page faults the parse thread took. Each pass carries analog,
+ * digital, I2C reply and string messages; every 64th adds a string long
+ * enough to span several reads.
+ * Fails if real-time parsing allocates or blocks.
+ *
+ *   realtime_benchmark [passes] [cpu] [SCHED_FIFO priority]
+ */
+
+typedef firmata::Firmata<firmata::Base, firmata::I2C> Board;
+
+static void buildPasses(std::vector<uint8_t>& pass, std::vector<uint8_t>& long_pass)
+{
+	uint8_t i2c_bytes[] = { 1, 2, 3, 4, 5, 6 };
+	for (uint8_t channel = 0; channel < 6; channel++) {
+		SimulatedBoard::analogMessage(pass, channel, 512 + channel);
+	}
+	SimulatedBoard::digitalMessage(pass, 0, 0x55);
+	SimulatedBoard::i2cReply(pass, 8, 0, i2c_bytes, sizeof(i2c_bytes));
+	SimulatedBoard::stringMessage(pass, "steady state");
+
+	long_pass = pass;
+	SimulatedBoard::stringMessage(long_pass, std::string(1800, 'x'));
+}
+
+static size_t runPasses(Board* f, SimulatedBoard* board, size_t passes, LatencyHistogram* latency)
+{
+	std::vector<uint8_t> pass, long_pass;
+	buildPasses(pass, long_pass);
+
+	size_t before = allocations;
+	for (size_t i = 0; i < passes; i++) {
+		board->feed(i % 64 == 63 ? long_pass : pass);
+		while (board->available()) {
+			auto start = std::chrono::steady_clock::now();
+			f->parse();
+			std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			if (latency) latency->record((uint64_t)elapsed.count());
+		}
+	}
+	return allocations - before;
+}
+
+int main(int argc, const char* argv[])
+{
+	size_t passes = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	firmata::RealtimeConfig config;
+	config.cpu = argc > 2 ? atoi(argv[2]) : 0;
+	config.priority = argc > 3 ? atoi(argv[3]) : 0;
+
+	SimulatedBoard* cold_board = new SimulatedBoard();
+	Board* cold = new Board(cold_board);
+	SimulatedBoard* rt_board = new SimulatedBoard();
+	Board* rt = new Board(rt_board);
+	if (!cold->ready() || !rt->ready()) {
+		std::cout << "Simulated board did not complete the handshake" << std::endl;
+		return 1;
+	}
+
+	// Plain Base prints strings; keep the comparison about buffers
+	std::streambuf* out = std::cout.rdbuf(NULL);
+	size_t cold_allocated = runPasses(cold, cold_board, 128, NULL);
+	std::cout.rdbuf(out);
+
+	firmata::RealtimeStatus status = rt->enterRealtime(config);
+	printf("pinned %d  scheduled %d  locked %d  error %d\n", status.pinned, status.scheduled, status.locked, status.error);
+
+	// The buffers the real-time board is about to grow into were reserved up front
+	size_t rt_allocated = runPasses(rt, rt_board, 128, NULL);
+	printf("first 128 passes: %zu allocations normally, %zu in real-time mode\n", cold_allocated, rt_allocated);
+
+	LatencyHistogram* latency = new LatencyHistogram();
+#ifdef __linux__
+	struct rusage before_usage, after_usage;
+	getrusage(RUSAGE_THREAD, &before_usage);
+#endif
+	size_t allocated = runPasses(rt, rt_board, passes, latency);
+	long switches = 0, faults = 0;
+#ifdef __linux__
+	getrusage(RUSAGE_THREAD, &after_usage);
+	switches = after_usage.ru_nvcsw - before_usage.ru_nvcsw;
+	faults = after_usage.ru_minflt - before_usage.ru_minflt + after_usage.ru_majflt - before_usage.ru_majflt;
+#endif
+
+	printf("parse calls:      %llu\n", (unsigned long long)latency->count());
+	printf("allocations:      %zu\n", allocated);
+	printf("blocking waits:   %ld voluntary context switches\n", switches);
+	printf("page faults:      %ld\n", faults);
+	printf("parse (ns):       p50 %llu  p99 %llu  p99.9 %llu  max %llu  mean %.0f\n",
+		(unsigned long long)latency->percentile(50), (unsigned long long)latency->percentile(99),
+		(unsigned long long)latency->percentile(99.9), (unsigned long long)latency->max(), latency->mean());
+
+	delete latency;
+	delete rt;
+	delete cold;
+	return rt_allocated == 0 && allocated == 0 && switches == 0 ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+#ifndef __SIMBOARD_H__
+#define __SIMBOARD_H__
+
+#include "firmata_constants.h"
+#include "firmi2c.h"
+#include "firmio.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+ * In-memory FirmIO standing in for a StandardFirmata board. It answers the
+ * handshake Base sends on construction and plays back whatever bytes the
+ * benchmark feeds it, without allocating once its buffer has grown.
+ */
+class SimulatedBoard : public firmata::FirmIO {
+public:
+	SimulatedBoard(uint8_t digital_pins = 14, uint8_t analog_pins = 6)
+		: m_digital_pins(digital_pins), m_analog_pins(analog_pins), m_read(0), m_open(false), m_written(0)
+	{
+		m_inbound.reserve(64 * FIRMATA_MSG_LEN);
+	}
+
+	virtual void open() override { m_open = true; }
+	virtual bool isOpen() override { return m_open; }
+	virtual void close() override { m_open = false; }
+	virtual size_t available() override { return m_inbound.size() - m_read; }
+
+	virtual std::vector<uint8_t> read(size_t size = 1) override
+	{
+		std::vector<uint8_t> bytes(size);
+		bytes.resize(read(bytes.data(), size));
+		return bytes;
+	}
+
+	virtual size_t read(uint8_t* buffer, size_t size) override
+	{
+		size_t count = available() < size ? available() : size;
+		if (count) memcpy(buffer, m_inbound.data() + m_read, count);
+		m_read += count;
+		return count;
+	}
+
+	virtual size_t write(std::vector<uint8_t> bytes) override
+	{
+		return write(bytes.data(), bytes.size());
+	}
+
+	virtual size_t write(const uint8_t* bytes, size_t size) override
+	{
+		m_written += size;
+		respond(firmata::ByteView(bytes, size));
+		return size;
+	}
+
+	void feed(const uint8_t* bytes, size_t size)
+	{
+		if (m_read) {
+			m_inbound.erase(m_inbound.begin(), m_inbound.begin() + m_read);
+			m_read = 0;
+		}
+		m_inbound.insert(m_inbound.end(), bytes, bytes + size);
+	}
+
+	void feed(const std::vector<uint8_t>& bytes) { feed(bytes.data(), bytes.size()); }
+
+	size_t written() const { return m_written; }
+
+	static void analogMessage(std::vector<uint8_t>& out, uint8_t channel, uint16_t value)
+	{
+		uint8_t message[] = { (uint8_t)(FIRMATA_ANALOG_MESSAGE | channel), (uint8_t)FIRMATA_LSB(value), (uint8_t)FIRMATA_MSB(value) };
+		out.insert(out.end(), message, message + sizeof(message));
+	}
+
+	static void digitalMessage(std::vector<uint8_t>& out, uint8_t port, uint8_t value)
+	{
+		uint8_t message[] = { (uint8_t)(FIRMATA_DIGITAL_MESSAGE | port), (uint8_t)FIRMATA_LSB(value), (uint8_t)FIRMATA_MSB(value) };
+		out.insert(out.end(), message, message + sizeof(message));
+	}
+
+	static void sysexMessage(std::vector<uint8_t>& out, uint8_t command, const uint8_t* bytes, size_t size)
+	{
+		out.push_back(FIRMATA_START_SYSEX);
+		out.push_back(command);
+		for (size_t i = 0; i < size; i++) {
+			out.push_back(FIRMATA_LSB(bytes[i]));
+			out.push_back(FIRMATA_MSB(bytes[i]));
+		}
+		out.push_back(FIRMATA_END_SYSEX);
+	}
+
+	static void stringMessage(std::vector<uint8_t>& out, const std::string& s)
+	{
+		sysexMessage(out, FIRMATA_STRING, (const uint8_t*)s.data(), s.size());
+	}
+
+	static void i2cReply(std::vector<uint8_t>& out, uint16_t address, uint16_t reg, const uint8_t* bytes, size_t size)
+	{
+		uint8_t header[] = { FIRMATA_START_SYSEX, FIRMATA_I2C_REPLY, (uint8_t)FIRMATA_LSB(address), (uint8_t)FIRMATA_MSB(address), (uint8_t)FIRMATA_LSB(reg), (uint8_t)FIRMATA_MSB(reg) };
+		out.insert(out.end(), header, header + sizeof(header));
+		for (size_t i = 0; i < size; i++) {
+			out.push_back(FIRMATA_LSB(bytes[i]));
+			out.push_back(FIRMATA_MSB(bytes[i]));
+		}
+		out.push_back(FIRMATA_END_SYSEX);
+	}
+
+private:
+	void respond(firmata::ByteView bytes)
+	{
+		std::vector<uint8_t> reply;
+		uint8_t pins = m_digital_pins + m_analog_pins;
+
+		for (size_t i = 0; i < bytes.size(); i++) {
+			if (bytes[i] == FIRMATA_REPORT_VERSION) {
+				uint8_t version[] = { FIRMATA_REPORT_VERSION, 2, 5 };
+				reply.insert(reply.end(), version, version + sizeof(version));
+			}
+			if (bytes[i] != FIRMATA_START_SYSEX || i + 1 >= bytes.size()) continue;
+
+			switch (bytes[i + 1]) {
+			case(FIRMATA_REPORT_FIRMWARE) : {
+				std::string name = "SimulatedFirmata.ino";
+				reply.push_back(FIRMATA_START_SYSEX);
+				reply.push_back(FIRMATA_REPORT_FIRMWARE);
+				reply.push_back(2);
+				reply.push_back(5);
+				for (char c : name) {
+					reply.push_back(FIRMATA_LSB(c));
+					reply.push_back(FIRMATA_MSB(c));
+				}
+				reply.push_back(FIRMATA_END_SYSEX);
+				break;
+			}
+			case(FIRMATA_CAPABILITY_QUERY) :
+				reply.push_back(FIRMATA_START_SYSEX);
+				reply.push_back(FIRMATA_CAPABILITY_RESPONSE);
+				for (uint8_t pin = 0; pin < pins; pin++) {
+					uint8_t digital[] = { MODE_INPUT, 1, MODE_OUTPUT, 1 };
+					reply.insert(reply.end(), digital, digital + sizeof(digital));
+					if (pin >= m_digital_pins) {
+						reply.push_back(MODE_ANALOG);
+						reply.push_back(10);
+					}
+					reply.push_back(127);
+				}
+				reply.push_back(FIRMATA_END_SYSEX);
+				break;
+			case(FIRMATA_ANALOG_MAPPING_QUERY) :
+				reply.push_back(FIRMATA_START_SYSEX);
+				reply.push_back(FIRMATA_ANALOG_MAPPING_RESPONSE);
+				for (uint8_t pin = 0; pin < pins; pin++) {
+					reply.push_back(pin >= m_digital_pins ? pin - m_digital_pins : 127);
+				}
+				reply.push_back(FIRMATA_END_SYSEX);
+				break;
+			case(FIRMATA_PIN_STATE_QUERY) :
+				if (i + 2 < bytes.size()) {
+					uint8_t pin = bytes[i + 2];
+					uint8_t state[] = { FIRMATA_START_SYSEX, FIRMATA_PIN_STATE_RESPONSE, pin,
+						(uint8_t)(pin >= m_digital_pins ? MODE_ANALOG : MODE_OUTPUT), 0, FIRMATA_END_SYSEX };
+					reply.insert(reply.end(), state, state + sizeof(state));
+				}
+				break;
+			}
+		}
+
+		if (reply.size()) feed(reply);
+	}
+
+	uint8_t m_digital_pins;
+	uint8_t m_analog_pins;
+	std::vector<uint8_t> m_inbound;
+	size_t m_read;
+	bool m_open;
+	size_t m_written;
+};
+
+#endif // !__SIMBOARD_H__
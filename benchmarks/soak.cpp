@@ -0,0 +1,390 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "firmata.h"
+#include "firmserial.h"
+#include "latency.h"
+#include "simboard.h"
+
+/*
+ * Soak the real FirmSerial path over a pseudo-terminal. A scripted board on
+ * the master end answers the handshake, then streams a fixed mix of analog,
+ * digital, I2C reply and string messages paced to the given baud rate, while
+ * Firmata<Base, I2C> parses the slave end on its own thread and the main
+ * thread keeps sending commands. Analog values carry a sequence number the
+ * board timestamped when it generated the message, so every delivered sample
+ * gives an end-to-end latency.
+ *
+ *   soak_benchmark [seconds] [baud] [analog:digital:i2c:string] [rt[:cpu[:priority]]]
+ *
+ * Defaults to 60 seconds at 115200 baud with a 6:1:1:1 mix. rt runs the
+ * parse thread in real-time mode, optionally pinned to cpu with SCHED_FIFO
+ * priority. Fails if any message or command is lost.
+ */
+
+enum MessageKind { KIND_ANALOG, KIND_DIGITAL, KIND_I2C, KIND_STRING, KINDS };
+static const char* kind_names[KINDS] = { "analog", "digital", "i2c", "string" };
+
+#define SOAK_SEQUENCES	(FIRMATA_MAX + 1)
+#define SOAK_DIGITAL_PIN	2
+
+// When each analog sequence number was generated, for the receiving side
+static std::atomic<uint32_t> sent_sequence[SOAK_SEQUENCES];
+static std::atomic<uint64_t> sent_time[SOAK_SEQUENCES];
+
+class PtyBoard {
+public:
+	PtyBoard(int master, uint32_t baud, const uint32_t mix[KINDS])
+		: throttled(0), host_bytes(0), m_master(master), m_baud(baud), m_running(false), m_streaming(false)
+	{
+		for (int kind = 0; kind < KINDS; kind++) {
+			for (uint32_t i = 0; i < mix[kind]; i++) m_pattern.push_back((MessageKind)kind);
+			sent[kind].store(0);
+		}
+		if (m_pattern.empty()) m_pattern.push_back(KIND_ANALOG);
+	}
+
+	void start()
+	{
+		m_running = true;
+		m_thread = std::thread(&PtyBoard::run, this);
+	}
+
+	void stream(bool on) { m_streaming = on; }
+
+	void stop()
+	{
+		m_running = false;
+		m_thread.join();
+	}
+
+	std::atomic<uint64_t> sent[KINDS];
+	std::atomic<uint64_t> throttled;	// ticks the pty was too full to keep up with the baud rate
+	std::atomic<uint64_t> host_bytes;	// bytes the host wrote to the board
+
+private:
+	void run()
+	{
+		SimulatedBoard handshake;
+		handshake.open();
+		std::vector<uint8_t> out;
+		out.reserve(1 << 16);
+		size_t out_begin = 0;
+		uint8_t in[256];
+
+		uint64_t stream_start = 0, generated = 0, analog_sequence = 0, pattern_index = 0;
+		uint8_t digital = 0;
+		uint8_t i2c_bytes[4];
+		uint64_t bytes_per_second = m_baud / 10;
+
+		while (m_running) {
+			struct pollfd p = { m_master, (short)(POLLIN | (out.size() > out_begin ? POLLOUT : 0)), 0 };
+			poll(&p, 1, 1);
+
+			ssize_t n = read(m_master, in, sizeof(in));
+			if (n > 0) {
+				host_bytes += n;
+				handshake.write(in, n);
+				while (handshake.available()) {
+					size_t count = handshake.read(in, sizeof(in));
+					out.insert(out.end(), in, in + count);
+				}
+			}
+
+			uint64_t now = firmata::monotonicMicros();
+			if (m_streaming && !stream_start) stream_start = now;
+			if (m_streaming) {
+				uint64_t allowed = (now - stream_start) * bytes_per_second / 1000000;
+
+				// A board blocks in Serial.write when its buffer is full; so does this one
+				if (out.size() - out_begin > bytes_per_second / 10) {
+					throttled++;
+					generated = allowed;
+				}
+
+				while (generated < allowed) {
+					size_t before = out.size();
+					MessageKind kind = m_pattern[pattern_index++ % m_pattern.size()];
+					switch (kind) {
+					case KIND_ANALOG: {
+						uint32_t slot = analog_sequence % SOAK_SEQUENCES;
+						sent_time[slot].store(firmata::monotonicMicros(), std::memory_order_relaxed);
+						sent_sequence[slot].store((uint32_t)analog_sequence, std::memory_order_release);
+						SimulatedBoard::analogMessage(out, analog_sequence % 6, (uint16_t)slot);
+						analog_sequence++;
+						break;
+					}
+					case KIND_DIGITAL:
+						digital ^= 1 << SOAK_DIGITAL_PIN;
+						SimulatedBoard::digitalMessage(out, 0, digital);
+						break;
+					case KIND_I2C:
+						for (size_t i = 0; i < sizeof(i2c_bytes); i++) i2c_bytes[i] = (uint8_t)(pattern_index >> (8 * i));
+						SimulatedBoard::i2cReply(out, 8, 0, i2c_bytes, sizeof(i2c_bytes));
+						break;
+					default:
+						SimulatedBoard::stringMessage(out, "soak");
+					}
+					sent[kind]++;
+					generated += out.size() - before;
+				}
+			}
+
+			if (out.size() > out_begin) {
+				ssize_t written = write(m_master, out.data() + out_begin, out.size() - out_begin);
+				if (written > 0) out_begin += written;
+				if (out_begin == out.size()) {
+					out.clear();
+					out_begin = 0;
+				}
+			}
+		}
+	}
+
+	int m_master;
+	uint32_t m_baud;
+	std::vector<MessageKind> m_pattern;
+	std::atomic<bool> m_running;
+	std::atomic<bool> m_streaming;
+	std::thread m_thread;
+};
+
+class SoakFirmata : public firmata::Firmata<firmata::Base, firmata::I2C> {
+public:
+	SoakFirmata(firmata::FirmIO* firmIO) : firmata::Base(firmIO), firmata::I2C(firmIO), firmata::Firmata<firmata::Base, firmata::I2C>(firmIO)
+	{
+		for (int kind = 0; kind < KINDS; kind++) delivered[kind] = 0;
+	}
+
+	uint64_t delivered[KINDS];
+
+protected:
+	virtual bool handleSysex(uint8_t command, firmata::ByteView data) override
+	{
+		if (command == FIRMATA_I2C_REPLY) delivered[KIND_I2C]++;
+		return firmata::Firmata<firmata::Base, firmata::I2C>::handleSysex(command, data);
+	}
+
+	virtual bool handleString(firmata::StringView) override
+	{
+		delivered[KIND_STRING]++;
+		return true;
+	}
+};
+
+// Runs on the parse thread only; other threads may read just the published percentiles
+class SoakListener : public firmata::SampleListener {
+public:
+	SoakListener(SoakFirmata* board) : skipped(0), unmatched(0), p50_us(0), p99_us(0), m_board(board), m_next(0), m_next_publish(0) {};
+
+	LatencyHistogram latency;
+	uint64_t skipped;	// sequence numbers never seen
+	uint64_t unmatched;	// overwritten before they arrived, so no latency
+	std::atomic<uint64_t> p50_us;	// as of the last second
+	std::atomic<uint64_t> p99_us;
+
+	virtual void onSample(uint8_t pin, uint32_t value, uint64_t timestamp) override
+	{
+		if (pin == SOAK_DIGITAL_PIN) {
+			m_board->delivered[KIND_DIGITAL]++;
+			return;
+		}
+		if (pin < 14) return;
+
+		// Rebuild the full sequence number from its low 14 bits
+		uint64_t sequence = m_next + ((value - m_next) % SOAK_SEQUENCES);
+		skipped += sequence - m_next;
+		m_next = sequence + 1;
+		m_board->delivered[KIND_ANALOG]++;
+
+		uint32_t slot = value % SOAK_SEQUENCES;
+		uint64_t sent = sent_time[slot].load(std::memory_order_relaxed);
+		if (sent_sequence[slot].load(std::memory_order_acquire) != (uint32_t)sequence || timestamp < sent) {
+			unmatched++;
+			return;
+		}
+		latency.record(timestamp - sent);
+
+		if (timestamp >= m_next_publish) {
+			p50_us.store(latency.percentile(50), std::memory_order_relaxed);
+			p99_us.store(latency.percentile(99), std::memory_order_relaxed);
+			m_next_publish = timestamp + 1000000;
+		}
+	}
+
+private:
+	SoakFirmata* m_board;
+	uint64_t m_next;
+	uint64_t m_next_publish;
+};
+
+static uint64_t residentBytes()
+{
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (!statm) return 0;
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(statm);
+	return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t threadCpuMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t processCpuMicros()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+int main(int argc, const char* argv[])
+{
+	uint64_t seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 60;
+	uint32_t baud = argc > 2 ? strtoul(argv[2], NULL, 10) : 115200;
+	uint32_t mix[KINDS] = { 6, 1, 1, 1 };
+	bool realtime = argc > 4 && strncmp(argv[4], "rt", 2) == 0;
+	firmata::RealtimeConfig rt_config;
+	if (realtime) sscanf(argv[4], "rt:%d:%d", &rt_config.cpu, &rt_config.priority);
+	if ((argc > 3 && sscanf(argv[3], "%u:%u:%u:%u", &mix[0], &mix[1], &mix[2], &mix[3]) != KINDS) || (argc > 4 && !realtime)) {
+		std::cout << "usage: " << argv[0] << " [seconds] [baud] [analog:digital:i2c:string] [rt[:cpu[:priority]]]" << std::endl;
+		return 1;
+	}
+
+	int master, slave;
+	char name[256];
+	if (openpty(&master, &slave, name, NULL, NULL) < 0) {
+		perror("openpty");
+		return 1;
+	}
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+	PtyBoard board(master, baud, mix);
+	board.start();
+
+	SoakFirmata* f;
+	try {
+		f = new SoakFirmata(new firmata::FirmSerial(name, baud, 0));
+	}
+	catch (firmata::IOException& e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	if (!f->ready()) {
+		std::cout << "Board on " << name << " did not complete the handshake" << std::endl;
+		return 1;
+	}
+
+	SoakListener listener(f);
+	f->addSampleListener(&listener);
+
+	std::atomic<bool> parsing(true);
+	std::atomic<uint64_t> parse_cpu(0);
+	std::thread parser([f, &parsing, &parse_cpu, realtime, rt_config] {
+		if (realtime) {
+			firmata::RealtimeStatus status = f->enterRealtime(rt_config);
+			printf("real-time: pinned %d  scheduled %d  locked %d  error %d\n", status.pinned, status.scheduled, status.locked, status.error);
+		}
+		uint64_t start = threadCpuMicros();
+		while (parsing) f->parse();
+		parse_cpu = threadCpuMicros() - start;
+	});
+
+	// Set modes once the pin state replies from the handshake are parsed
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	f->pinMode(SOAK_DIGITAL_PIN, MODE_INPUT);
+	f->pinMode(13, MODE_OUTPUT);
+
+	printf("%s at %u baud, mix %u:%u:%u:%u, %llu s\n", name, baud, mix[0], mix[1], mix[2], mix[3], (unsigned long long)seconds);
+	// Memory growth counts from 10 s in (or half way), once buffers and rings have been touched
+	uint64_t rss_start = residentBytes(), rss_max = rss_start, rss_warm = 0;
+	uint64_t warm_up = seconds < 20 ? seconds * 500000 : 10000000;
+	uint64_t cpu_start = processCpuMicros();
+	uint64_t start = firmata::monotonicMicros(), end = start + seconds * 1000000, next_report = start + 10000000;
+	uint64_t commands = 0;
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	uint64_t host_bytes_start = board.host_bytes;
+	board.stream(true);
+
+	// Commands go out at 100 Hz alongside the stream
+	while (firmata::monotonicMicros() < end) {
+		f->digitalWrite(13, commands & 1);
+		commands++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		uint64_t now = firmata::monotonicMicros();
+		uint64_t rss = residentBytes();
+		if (rss > rss_max) rss_max = rss;
+		if (!rss_warm && now - start >= warm_up) rss_warm = rss;
+		if (now >= next_report) {
+			printf("%5llu s  sent %llu  p50 %llu us  p99 %llu us  rss %+lld kB\n", (unsigned long long)((now - start) / 1000000),
+				(unsigned long long)board.sent[KIND_ANALOG].load(), (unsigned long long)listener.p50_us.load(),
+				(unsigned long long)listener.p99_us.load(), (long long)(rss - rss_start) / 1024);
+			next_report += 10000000;
+		}
+	}
+
+	uint64_t rss_end = residentBytes();
+	if (!rss_warm) rss_warm = rss_end;
+
+	// Let the link drain before counting
+	board.stream(false);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+	parsing = false;
+	parser.join();
+	uint64_t cpu = processCpuMicros() - cpu_start;
+	board.stop();
+
+	uint64_t sent = 0, delivered = 0;
+	bool lost = false;
+	printf("\n%-10s %12s %12s\n", "", "sent", "delivered");
+	for (int kind = 0; kind < KINDS; kind++) {
+		sent += board.sent[kind];
+		delivered += f->delivered[kind];
+		lost |= f->delivered[kind] != board.sent[kind];
+		printf("%-10s %12llu %12llu\n", kind_names[kind], (unsigned long long)board.sent[kind].load(), (unsigned long long)f->delivered[kind]);
+	}
+
+	// Each digitalWrite is 3 bytes
+	uint64_t command_bytes = board.host_bytes - host_bytes_start;
+	lost |= command_bytes != commands * 3;
+
+	LatencyHistogram& latency = listener.latency;
+	printf("\nanalog gaps:      %llu\n", (unsigned long long)listener.skipped);
+	printf("latency (us):     p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu  (%llu samples, %llu unmatched)\n",
+		(unsigned long long)latency.percentile(50), (unsigned long long)latency.percentile(90), (unsigned long long)latency.percentile(99),
+		(unsigned long long)latency.percentile(99.9), (unsigned long long)latency.max(), (unsigned long long)latency.count(), (unsigned long long)listener.unmatched);
+	printf("parse cpu:        %.2f us/message\n", delivered ? (double)parse_cpu / delivered : 0.0);
+	printf("process cpu:      %.2f us/message (includes the simulated board)\n", delivered ? (double)cpu / delivered : 0.0);
+	printf("rss growth:       %+lld kB after warm-up, %+lld kB in all (peak %+lld kB)\n", (long long)(rss_end - rss_warm) / 1024,
+		(long long)(rss_end - rss_start) / 1024, (long long)(rss_max - rss_start) / 1024);
+	printf("board throttled:  %llu ticks\n", (unsigned long long)board.throttled.load());
+	printf("commands:         %llu sent, %llu bytes received\n", (unsigned long long)commands, (unsigned long long)command_bytes);
+
+	delete f;
+	close(master);
+	close(slave);
+	return lost ? 1 : 0;
+}
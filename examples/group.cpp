@@ -0,0 +1,86 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "firmata.h"
+#include "firmgroup.h"
+#include "firmserial.h"
+
+/*
+ * Read A0 on several boards, each parsed on its own thread, and print one
+ * interpolated frame per tick at 20 Hz for the given number of seconds
+ *
+ *   group_example <seconds> <port> [port...]
+ */
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 3) {
+		std::cout << "usage: " << argv[0] << " <seconds> <port> [port...]" << std::endl;
+		return 1;
+	}
+	uint64_t seconds = strtoul(argv[1], NULL, 10);
+
+	std::vector<firmata::Firmata<firmata::Base>*> boards;
+	try {
+		for (int i = 2; i < argc; i++) {
+			firmata::Firmata<firmata::Base>* f = new firmata::Firmata<firmata::Base>(new firmata::FirmSerial(argv[i]));
+			if (!f->ready()) return 1;
+			boards.push_back(f);
+		}
+	}
+	catch (firmata::IOException e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+
+	// The group unsubscribes when it goes out of scope, so the boards must outlive it
+	{
+		firmata::SamplingGroupConfig config;
+		config.rate_hz = 20;
+		config.mode = firmata::ALIGN_INTERPOLATE;
+		firmata::SamplingGroup group(config);
+		for (auto f : boards) {
+			group.subscribe(f, f->analogChannel("A0"));
+			f->reportAnalog(0, 1);
+		}
+
+		std::atomic<bool> running(true);
+		std::vector<std::thread> parsers;
+		for (auto f : boards) {
+			parsers.push_back(std::thread([f, &running] {
+				while (running) f->parse();
+			}));
+		}
+
+		group.start();
+		firmata::AlignedFrame frame;
+		uint64_t end = firmata::monotonicMicros() + seconds * 1000000;
+		while (firmata::monotonicMicros() < end) {
+			if (!group.nextFrame(frame)) continue;
+
+			printf("%10llu", (unsigned long long)frame.timestamp);
+			for (size_t i = 0; i < frame.values.size(); i++) {
+				printf("  %7.1f%s", frame.values[i], frame.stale[i] ? "*" : " ");
+			}
+			printf("\n");
+		}
+		group.stop();
+
+		running = false;
+		for (auto& parser : parsers) parser.join();
+
+		firmata::GroupStats stats = group.stats();
+		for (size_t i = 0; i < stats.boards.size(); i++) {
+			firmata::GroupBoardStats& board = stats.boards[i];
+			printf("%s: %llu samples, skew %.0f us (max %llu), staleness max %llu us, %llu stale frames\n",
+				argv[i + 2], (unsigned long long)board.samples, board.skew_us, (unsigned long long)board.max_skew_us,
+				(unsigned long long)board.max_staleness_us, (unsigned long long)board.stale_frames);
+		}
+	}
+
+	for (auto f : boards) delete f;
+}
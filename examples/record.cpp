@@ -0,0 +1,55 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "firmata.h"
+#include "firmrecord.h"
+#include "firmserial.h"
+
+/*
+ * Record analog inputs A0-A5 of the board on the given port to a file
+ * for the given number of seconds, then print how much was written
+ *
+ *   record_example <port> <file> [seconds]
+ */
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 3) {
+		std::cout << "usage: " << argv[0] << " <port> <file> [seconds]" << std::endl;
+		return 1;
+	}
+	uint64_t seconds = argc > 3 ? strtoul(argv[3], NULL, 10) : 10;
+
+	try {
+		firmata::Firmata<firmata::Base>* f = new firmata::Firmata<firmata::Base>(new firmata::FirmSerial(argv[1]));
+		if (!f->ready()) return 1;
+
+		firmata::Recorder recorder(argv[2]);
+		if (!recorder.isOpen()) return 1;
+		f->addSampleListener(&recorder);
+
+		for (uint8_t channel = 0; channel < 6; channel++) {
+			f->reportAnalog(channel, 1);
+		}
+
+		uint64_t end = firmata::monotonicMicros() + seconds * 1000000;
+		while (firmata::monotonicMicros() < end) {
+			f->parse();
+		}
+
+		f->removeSampleListener(&recorder);
+		recorder.close();
+
+		firmata::RecorderStats stats = recorder.stats();
+		std::cout << stats.samples << " samples, " << stats.bytes_written << " bytes, "
+			<< stats.dropped_samples << " dropped" << std::endl;
+
+		delete f;
+	}
+	catch (firmata::IOException e) {
+		std::cout << e.what() << std::endl;
+	}
+	catch (firmata::NotOpenException e) {
+		std::cout << e.what() << std::endl;
+	}
+}
@@ -1,12 +1,9 @@
 #include <iostream>
 
 #include "firmata.h"
+#include "firmdiscover.h"
 #include "firmserial.h"
 
-#ifndef WIN32
-#include "unistd.h"
-#endif
-
 /*
  * Detect first serial port with a StandardFirmata interface
  * Read analog inputs A0 and A1 and digital pin 2 (eg, a Playstation analog stick + button)
@@ -16,37 +13,25 @@
 
 int main(int argc, const char* argv[])
 {
-	std::vector<firmata::PortInfo> ports = firmata::FirmSerial::listPorts();
+	std::vector<firmata::DiscoveredBoard> boards = firmata::discover();
 	firmata::Firmata<firmata::Base, firmata::I2C>* f = NULL;
-	firmata::FirmSerial* serialio;
-
-	for (auto port : ports) {
-		std::cout << port.port << std::endl;
 
-		if (f != NULL) {
-			delete f;
-			f = NULL;
-		}
+	for (size_t i = 0; i < boards.size(); i++) {
+		std::cout << boards[i].port.port << std::endl;
 
-		try {
-			serialio = new firmata::FirmSerial(port.port.c_str());
-#ifndef WIN32
-			if (serialio->available()) {
-				sleep(3); // Seems necessary on linux
-				f = new firmata::Firmata<firmata::Base, firmata::I2C>(serialio);
+		if (f == NULL) {
+			try {
+				f = new firmata::Firmata<firmata::Base, firmata::I2C>(boards[i].serial, boards[i].identity);
+			}
+			catch(firmata::IOException e) {
+				std::cout << e.what() << std::endl;
+			}
+			catch(firmata::NotOpenException e) {
+				std::cout << e.what() << std::endl;
 			}
-#else
-			f = new firmata::Firmata<firmata::Base, firmata::I2C>(serialio);
-#endif
-		} 
-		catch(firmata::IOException e) {
-			std::cout << e.what() << std::endl;
-		}
-		catch(firmata::NotOpenException e) {
-			std::cout << e.what() << std::endl;
 		}
-		if (f != NULL && f->ready()) {
-			break;
+		else {
+			delete boards[i].serial;
 		}
 	}
 
@@ -0,0 +1,238 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "firmata.h"
+#include "../benchmarks/simboard.h"
+
+/*
+ * Property test for the parser. Each stream mixes well-formed messages, sysex
+ * payloads from empty up to past FIRMATA_MAX_SYSEX for every command Base and
+ * I2C handle, and random bytes, then mutates some of it (flipped bits, dropped,
+ * inserted and repeated bytes). A fresh Firmata<Base, I2C>, sometimes in
+ * real-time mode, reads it in random-sized pieces with random num_commands.
+ * Build with FIRMATA_BUILD_FUZZ so ASan and UBSan check every access.
+ *
+ * After each stream:
+ *  - every byte is counted in linkStats().bytes_received
+ *  - a marker string sent after the stream arrives intact, so the parser
+ *    resynchronized however the stream ended
+ *  - a report version sent after that is parsed at once, so nothing was left over
+ *  - malformed_messages never goes down, and snapshots match pinCount()
+ *  - versions and pin modes only ever come from data bytes, so they stay
+ *    below 0x80 (modes are 255 until known); a handler reading past its
+ *    payload picks up the END_SYSEX
+ *
+ *   parser_fuzz [streams] [seed]
+ */
+
+class FuzzBoard : public SimulatedBoard {
+public:
+	FuzzBoard() : chunk(FIRMATA_MSG_LEN) {};
+
+	size_t chunk;
+
+	virtual size_t read(uint8_t* buffer, size_t size) override
+	{
+		return SimulatedBoard::read(buffer, size < chunk ? size : chunk);
+	}
+};
+
+class FuzzFirmata : public firmata::Firmata<firmata::Base, firmata::I2C> {
+public:
+	FuzzFirmata(firmata::FirmIO* firmIO) : firmata::Base(firmIO), firmata::I2C(firmIO), firmata::Firmata<firmata::Base, firmata::I2C>(firmIO) {};
+
+	std::string last_string;
+
+protected:
+	virtual bool handleString(firmata::StringView data) override
+	{
+		last_string = data.toString();
+		return true;
+	}
+};
+
+static const uint8_t sysex_commands[] = {
+	FIRMATA_REPORT_FIRMWARE, FIRMATA_CAPABILITY_RESPONSE, FIRMATA_ANALOG_MAPPING_RESPONSE,
+	FIRMATA_PIN_STATE_RESPONSE, FIRMATA_STRING, FIRMATA_I2C_REPLY, FIRMATA_EXTENDED_ANALOG
+};
+
+static size_t bodySize(std::mt19937& random)
+{
+	switch (random() % 8) {
+	case 0: return 0;
+	case 1: return 1 + random() % 5;
+	case 2: return random() % 300;
+	case 3: return FIRMATA_MAX_SYSEX - 8 + random() % 16;
+	default: return random() % 24;
+	}
+}
+
+static void appendMessage(std::vector<uint8_t>& out, std::mt19937& random)
+{
+	uint8_t lsb = random() & 0x7F, msb = random() & 0x7F;
+	switch (random() % 5) {
+	case 0:
+		SimulatedBoard::analogMessage(out, random() % 16, (uint16_t)FIRMATA_COMBINE_LSB_MSB(lsb, msb));
+		break;
+	case 1:
+		SimulatedBoard::digitalMessage(out, random() % 16, lsb);
+		break;
+	case 2:
+		out.push_back(FIRMATA_REPORT_VERSION);
+		out.push_back(lsb);
+		out.push_back(msb);
+		break;
+	default: {
+		// Mostly commands that are handled, with bodies that are often too short for them
+		uint8_t command = random() % 4 ? sysex_commands[random() % sizeof(sysex_commands)] : random() & 0x7F;
+		size_t size = bodySize(random);
+		out.push_back(FIRMATA_START_SYSEX);
+		out.push_back(command);
+		for (size_t i = 0; i < size; i++) {
+			// Capability responses are made of 127s and small numbers
+			out.push_back(random() % 4 ? random() & 0x7F : (random() % 2 ? 127 : random() % 16));
+		}
+		out.push_back(FIRMATA_END_SYSEX);
+		break;
+	}
+	}
+}
+
+static void mutate(std::vector<uint8_t>& stream, std::mt19937& random)
+{
+	if (stream.empty()) return;
+
+	size_t at = random() % stream.size();
+	switch (random() % 5) {
+	case 0:
+		stream[at] ^= 1 << (random() % 8);
+		break;
+	case 1:
+		stream.erase(stream.begin() + at);
+		break;
+	case 2:
+		stream.insert(stream.begin() + at, (uint8_t)random());
+		break;
+	case 3:
+		stream.insert(stream.begin() + at, random() % 2 ? FIRMATA_START_SYSEX : FIRMATA_END_SYSEX);
+		break;
+	default: {
+		size_t size = random() % 16;
+		if (at + size > stream.size()) size = stream.size() - at;
+		std::vector<uint8_t> repeated(stream.begin() + at, stream.begin() + at + size);
+		stream.insert(stream.begin() + random() % stream.size(), repeated.begin(), repeated.end());
+		break;
+	}
+	}
+}
+
+static void buildStream(std::vector<uint8_t>& stream, std::mt19937& random)
+{
+	stream.clear();
+	size_t pieces = 1 + random() % 32;
+	for (size_t i = 0; i < pieces; i++) {
+		if (random() % 4) {
+			appendMessage(stream, random);
+		}
+		else {
+			size_t size = random() % 64;
+			for (size_t j = 0; j < size; j++) stream.push_back((uint8_t)random());
+		}
+	}
+
+	size_t mutations = random() % 3 ? random() % 8 : 0;
+	for (size_t i = 0; i < mutations; i++) mutate(stream, random);
+}
+
+static bool fail(const char* what, size_t stream_index, uint32_t seed, const std::vector<uint8_t>& stream)
+{
+	printf("FAILED: %s on stream %zu of seed %u (%zu bytes):", what, stream_index, seed, stream.size());
+	for (size_t i = 0; i < stream.size() && i < 256; i++) printf(" %02X", stream[i]);
+	printf("%s\n", stream.size() > 256 ? " ..." : "");
+	return false;
+}
+
+static bool runStream(size_t index, uint32_t seed, std::mt19937& random, std::vector<uint8_t>& stream)
+{
+	buildStream(stream, random);
+
+	FuzzBoard* board = new FuzzBoard();
+	FuzzFirmata f(board);
+	if (!f.ready()) return fail("handshake", index, seed, stream);
+	if (random() % 4 == 0) {
+		firmata::RealtimeConfig config;
+		config.lock_memory = false;
+		f.enterRealtime(config);
+	}
+
+	// Whatever the handshake left unread goes first, so only the stream is counted
+	while (board->available()) f.parse();
+	firmata::LinkStats before = f.linkStats();
+	char marker[32];
+	snprintf(marker, sizeof(marker), "marker %zu", index);
+	std::vector<uint8_t> fed = stream;
+	SimulatedBoard::stringMessage(fed, marker);
+
+	// Partly up front and partly while parsing, so messages land across reads
+	size_t split = random() % (fed.size() + 1);
+	board->feed(fed.data(), split);
+	uint64_t malformed = before.malformed_messages;
+	while (board->available() || split < fed.size()) {
+		if (split < fed.size() && random() % 2) {
+			size_t size = 1 + random() % (fed.size() - split);
+			board->feed(fed.data() + split, size);
+			split += size;
+		}
+		board->chunk = random() % 4 ? 1 + random() % 64 : FIRMATA_MSG_LEN;
+		f.parse(random() % 3 ? 0 : 1 + random() % 3);
+
+		uint64_t now = f.linkStats().malformed_messages;
+		if (now < malformed) return fail("malformed_messages went down", index, seed, stream);
+		malformed = now;
+		if (f.major_version >= 0x80 || f.minor_version >= 0x80) return fail("version from a status byte", index, seed, stream);
+	}
+	board->chunk = FIRMATA_MSG_LEN;
+	f.parse();
+
+	firmata::LinkStats after = f.linkStats();
+	if (after.bytes_received - before.bytes_received != fed.size()) return fail("bytes_received", index, seed, stream);
+	if (f.last_string != marker) return fail("marker after the stream", index, seed, stream);
+
+	uint8_t version[] = { FIRMATA_REPORT_VERSION, 2, 5 };
+	board->feed(version, sizeof(version));
+	if (f.parse() != FIRMATA_REPORT_VERSION || f.major_version != 2 || f.minor_version != 5) {
+		return fail("report version after the marker", index, seed, stream);
+	}
+
+	firmata::Snapshot snapshot;
+	f.snapshot(snapshot);
+	if (snapshot.modes.size() != f.pinCount() || snapshot.values.size() != f.pinCount()) {
+		return fail("snapshot size", index, seed, stream);
+	}
+	for (uint8_t mode : snapshot.modes) {
+		if (mode >= 0x80 && mode != 255) return fail("pin mode from a status byte", index, seed, stream);
+	}
+	return true;
+}
+
+int main(int argc, const char* argv[])
+{
+	size_t streams = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+	uint32_t seed = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+
+	std::mt19937 random(seed);
+	std::vector<uint8_t> stream;
+	size_t bytes = 0;
+	for (size_t i = 0; i < streams; i++) {
+		if (!runStream(i, seed, random, stream)) return 1;
+		bytes += stream.size();
+	}
+
+	std::cout << "streams: " << streams << std::endl;
+	std::cout << "bytes:   " << bytes << std::endl;
+	return 0;
+}
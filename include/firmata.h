@@ -13,10 +13,11 @@ namespace FIRMATACPP_EXPORT firmata {
 	{
 	public:
 		Firmata(FirmIO* firmIO) : Extensions(firmIO)... {};
+		Firmata(FirmIO* firmIO, const FirmwareIdentity& identity) : Extensions(firmIO, identity)... {};
 		virtual ~Firmata() {};
 
 	protected:
-		virtual bool handleSysex(uint8_t command, std::vector<uint8_t> data) override
+		virtual bool handleSysex(uint8_t command, ByteView data) override
 		{
 			bool handled[] = { (Extensions::handleSysex(command, data))... };
 
@@ -26,7 +27,7 @@ namespace FIRMATACPP_EXPORT firmata {
 
 			return false;
 		}
-		virtual bool handleString(std::string data) override
+		virtual bool handleString(StringView data) override
 		{
 			bool handled[] = { (Extensions::handleString(data))... };
 
@@ -36,6 +37,26 @@ namespace FIRMATACPP_EXPORT firmata {
 
 			return false;
 		}
+		virtual void replayConfiguration() override
+		{
+			int replayed[] = { (Extensions::replayConfiguration(), 0)... };
+			(void)replayed;
+		}
+		virtual void describeReports(ReportConfig& config) override
+		{
+			int described[] = { (Extensions::describeReports(config), 0)... };
+			(void)described;
+		}
+		virtual void publishState(ShmPublisher& publisher, bool full) override
+		{
+			int published[] = { (Extensions::publishState(publisher, full), 0)... };
+			(void)published;
+		}
+		virtual void reserveBuffers() override
+		{
+			int reserved[] = { (Extensions::reserveBuffers(), 0)... };
+			(void)reserved;
+		}
 	};
 }
 
@@ -1,6 +1,7 @@
 #ifndef __FIRMATA_CONSTANTS_H__
 #define __FIRMATA_CONSTANTS_H__
 
+#include <atomic>
 #include <vector>
 #include <stdint.h>
 
@@ -59,12 +60,24 @@
 
 #define FIRMATA_MAX						0x3FFF
 #define FIRMATA_MSG_LEN					1024
+#define FIRMATA_MAX_SYSEX				4096 // longest sysex buffered while waiting for END_SYSEX
+#define FIRMATA_DEFAULT_SAMPLING_INTERVAL	19 // ms, StandardFirmata's default
+#define FIRMATA_DEFAULT_PINS			128 // pin table size until the capability response arrives
+#define FIRMATA_MAX_PINS				128 // pins a message can address; the pin travels as one data byte
+#define FIRMATA_NO_ANALOG_CHANNEL		127 // analog mapping response's marker for a pin without one
+#define FIRMATA_NO_PIN					0x100 // marks an unmapped analog channel; outside the uint8_t pin range
 
+// Hot per-pin state, touched by every incoming message
+typedef struct		s_pin_state
+{
+	std::atomic<uint32_t>	value;
+	std::atomic<uint8_t>	mode;
+} t_pin_state;
+
+// Cold per-pin capabilities, filled in by init()
 typedef struct		s_pin
 {
-	uint8_t				mode;
 	uint8_t				analog_channel;
-	uint32_t				value;
 	std::vector<uint8_t>	supported_modes;
 	std::vector<uint8_t>	resolutions;
 } t_pin;
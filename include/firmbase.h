@@ -3,26 +3,109 @@
 
 #include <firmatacpp_export.h>
 #include "firmata_constants.h"
+#include "firmbudget.h"
+#include "firmencode.h"
+#include "firmfilter.h"
+#include "firmflight.h"
 #include "firmio.h"
+#include "firmrealtime.h"
+#include "firmshm.h"
+#include "firmstate.h"
+#include "firmview.h"
 
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 namespace firmata {
 
+	// Analog channel resolved to its pin once, so reads and writes skip the lookup
+	typedef struct AnalogChannel {
+		uint16_t pin;	// FIRMATA_NO_PIN if the channel isn't mapped
+	} AnalogChannel;
+
+	// What answered REPORT_FIRMWARE; a board that reports the same identity
+	// again after a reconnect is assumed to have the same pins
+	typedef struct FirmwareIdentity {
+		std::string name;
+		int major_version;
+		int minor_version;
+	} FirmwareIdentity;
+
+	typedef struct ConnectionStats {
+		bool connected;
+		uint32_t disconnects;
+		uint32_t reconnects;
+		uint32_t failed_attempts;
+		uint32_t fast_reconnects;	// reconnects that skipped the capability queries
+		uint64_t last_reconnect_us;	// time spent in the last successful reconnect
+		uint64_t last_downtime_us;
+		uint64_t total_downtime_us;
+	} ConnectionStats;
+
+	// Urgent messages are written as soon as they're sent; bulk messages
+	// queue behind the bulk bandwidth cap. Messages are never split.
+	enum Priority {
+		PRIORITY_URGENT,
+		PRIORITY_BULK
+	};
+
+	typedef struct OutboundClassStats {
+		uint64_t messages;
+		uint64_t bytes;
+		uint64_t total_latency_us;	// from send to written, summed over messages
+		uint64_t max_latency_us;
+		uint64_t queued_bytes;
+	} OutboundClassStats;
+
+	typedef struct OutboundStats {
+		OutboundClassStats urgent;
+		OutboundClassStats bulk;
+	} OutboundStats;
+
+	// Counted by parse(); readable from any thread
+	typedef struct LinkStats {
+		uint64_t bytes_received;
+		uint64_t malformed_messages;	// noise skipped, and messages cut short or too short to read
+		uint64_t partial_reads;		// reads that ended mid-message
+	} LinkStats;
+
 	class FIRMATACPP_EXPORT Base {
 	public:
 		Base(FirmIO *firmIO);
+		// For a link whose handshake was already done, e.g. by discover()
+		Base(FirmIO *firmIO, const FirmwareIdentity& identity);
 		virtual ~Base();
 
 		void init();
 
-		bool is_ready;
+		std::atomic<bool> is_ready;
 		std::string name;
 		int major_version;
 		int minor_version;
 
 		bool ready();
 
+		FirmwareIdentity firmwareIdentity();
+
+		// Reopen the link and replay the configuration set through this object.
+		// The capability and analog mapping queries are skipped when the same
+		// firmware answers. Returns false instead of throwing on IO errors.
+		bool reconnect(uint32_t timeout = 1000);
+		// With auto reconnect on, IO errors mark the link down instead of throwing;
+		// writes are dropped (but still recorded) and parse() retries every retry_ms
+		void setAutoReconnect(bool enable, uint32_t retry_ms = 500);
+		bool connected();
+		ConnectionStats connectionStats();
+		LinkStats linkStats();
+
+		// Commands sent between these are written to the link in one go. One thread
+		// at a time may batch; other threads' commands go out as they're sent.
+		void beginBatch();
+		void endBatch();
+
 		uint16_t parse(uint32_t num_commands = 0);
 
 		void pinMode(uint8_t pin, uint8_t mode);
@@ -34,37 +117,241 @@ namespace firmata {
 		uint32_t analogRead(uint8_t pin);
 		uint32_t analogRead(const std::string& channel);
 
-		void standardCommand(std::vector<uint8_t> standard_command);
-		void sysexCommand(uint8_t sysex_command);
-		void sysexCommand(std::vector<uint8_t> sysex_command);
+		// Resolve "A0".."A<n>" once; pin is FIRMATA_NO_PIN if the channel isn't mapped.
+		// parse() rebuilds the capabilities and the analog mapping when the board
+		// sends them again or a reconnect finds new firmware, so call these and
+		// pinCapabilities() before parsing starts or on the parse thread.
+		AnalogChannel analogChannel(const std::string& channel);
+		AnalogChannel analogChannel(uint8_t channel);
+		uint32_t analogRead(AnalogChannel channel);
+		void analogWrite(AnalogChannel channel, uint32_t value);
+
+		size_t pinCount();
+		const t_pin* pinCapabilities(uint8_t pin);
+
+		// Consistent with one whole parse pass; from a handler or listener inside
+		// parse(), the pass so far
+		void snapshot(Snapshot& snapshot);
+
+		// Run each sample of an analog channel through a filter chain inside parse().
+		// Base takes ownership; set filters before parsing starts. NULL removes it.
+		void setAnalogFilter(AnalogChannel channel, FilterChain* filter);
+		// Latest filter output, or the raw value if the channel has no filter
+		double analogReadFiltered(uint8_t pin);
+		double analogReadFiltered(const std::string& channel);
+		double analogReadFiltered(AnalogChannel channel);
+
+		// Register before parsing starts; listeners are called from parse() and may
+		// read state, snapshot() included, but must not call parse()
+		void addSampleListener(SampleListener* listener);
+		void removeSampleListener(SampleListener* listener);
+
+		// Write board state to publisher after every parse pass; NULL stops.
+		// The publisher isn't owned and must outlive the board or be detached.
+		void publish(ShmPublisher* publisher);
+
+		// The last raw reads, writes and parsed message headers. Dumped automatically
+		// on timeouts and IO exceptions once a dump prefix is set.
+		FlightRecorder& flightRecorder();
+
+		// Opt-in real-time mode; call from the thread that runs parse(), which it pins,
+		// schedules and locks as config asks. Buffers are sized now and after every
+		// handshake. parse() then only asks the transport for bytes already waiting,
+		// leaves bulk traffic to pumpOutbound() on the sending side, and doesn't print
+		// strings, so the steady state neither allocates nor makes blocking calls
+		// apart from the transport read.
+		RealtimeStatus enterRealtime(const RealtimeConfig& config = RealtimeConfig());
+		bool realtime();
 
-		void reportAnalog(uint8_t channel, uint8_t enable = 1);
-		void reportDigital(uint8_t port, uint8_t enable = 1);
-		void setSamplingInterval(uint32_t intervalms);
+		// Any thread may send while another runs parse(), though only one at a time may batch.
+		// Send a message encoded with firmencode.h as is
+		void sendMessage(const uint8_t* message, size_t size, Priority priority = PRIORITY_BULK);
+		template< size_t N >
+		void sendMessage(const Message<N>& message, Priority priority = PRIORITY_BULK)
+		{
+			sendMessage(message.data(), N, priority);
+		}
+
+		void standardCommand(std::vector<uint8_t> standard_command, Priority priority = PRIORITY_BULK);
+		void sysexCommand(uint8_t sysex_command, Priority priority = PRIORITY_BULK);
+		void sysexCommand(std::vector<uint8_t> sysex_command, Priority priority = PRIORITY_BULK);
+
+		// pinMode, digitalWrite and analogWrite on pin are sent with this priority
+		void setPinPriority(uint8_t pin, Priority priority);
+		// Cap bulk traffic at bytes_per_second, with bursts of up to burst_bytes;
+		// 0 removes the cap. Senders block once max_queued_bytes are waiting.
+		void setBulkBandwidth(uint32_t bytes_per_second, uint32_t burst_bytes = 64, uint32_t max_queued_bytes = 4096);
+		// Write whatever bulk traffic the cap allows now; parse() does this too, except in real-time mode
+		void pumpOutbound();
+		// Block until all queued bulk traffic is written
+		void flushOutbound();
+		OutboundStats outboundStats();
+
+		// These return false if the bandwidth budget refused the request
+		bool reportAnalog(uint8_t channel, uint8_t enable = 1);
+		bool reportDigital(uint8_t port, uint8_t enable = 1);
+		bool setSamplingInterval(uint32_t intervalms);
+		uint32_t samplingInterval();
+
+		// Check requests that add reports, or sample faster, against the link.
+		// headroom is the largest share of the link's capacity reports may use.
+		void setBandwidthBudget(uint32_t baudrate, double headroom = 0.8, BudgetAction action = BUDGET_WARN);
+		// The reports currently enabled, for estimateBandwidth()
+		ReportConfig reportConfig();
 
 	protected:
-		virtual bool handleSysex(uint8_t command, std::vector<uint8_t> data);
-		virtual bool handleString(std::string data);
+		// data is only valid until the handler returns. Handlers may read state, snapshot()
+		// and readI2C() included, but must not call parse().
+		virtual bool handleSysex(uint8_t command, ByteView data);
+		virtual bool handleString(StringView data);
+		// Re-send extension configuration after a reconnect; runs inside a batch
+		virtual void replayConfiguration();
+		// Add extension reports to config
+		virtual void describeReports(ReportConfig& config);
+		// Add extension state to a parse pass being published; full after the
+		// publisher is attached or the firmware changes
+		virtual void publishState(ShmPublisher& publisher, bool full);
+		// Size extension buffers for real-time mode, once the capabilities are known
+		virtual void reserveBuffers();
+		// Whether admitReports() checks anything; building a proposal isn't free
+		bool budgetEnabled();
+		bool admitReports(const ReportConfig& proposed);
 
 		bool awaitResponse(uint8_t command, uint32_t timeout = 1000);
 		bool awaitSysexResponse(uint8_t sysexCommand, uint32_t timeout = 1000);
 
 	private:
+		Base(FirmIO *firmIO, const FirmwareIdentity* identity);
+
 		void initPins();
+		void resizePins(size_t count);
+		t_pin_state* pinState(uint8_t pin);
 		void reportFirmware();
 		void capabilityQuery();
 		void analogMappingQuery();
 		void pinStateQuery();
 
-		std::string stringFromBytes(std::vector<uint8_t>::iterator begin, std::vector<uint8_t>::iterator end);
+		StringView stringFromBytes(ByteView bytes);
 
 		void analogWriteExtended(uint8_t pin, uint32_t value);
-		void savePartialBuffer(std::vector<uint8_t>::iterator begin, std::vector<uint8_t>::iterator end);
-		std::vector<uint8_t> saved_buffer;
+		void send(const uint8_t* bytes, size_t size, Priority priority);
+		void sendLocked(const uint8_t* bytes, size_t size, Priority priority, std::unique_lock<std::mutex>& lock);
+		void queue(const uint8_t* bytes, size_t size, Priority priority);
+		void awaitQueueRoom(std::unique_lock<std::mutex>& lock);
+		void write(const uint8_t* bytes, size_t size, uint64_t queued, OutboundClassStats& stats);
+		void pumpBulk();
+		uint64_t bulkWait();
+		Priority pinPriority(uint8_t pin);
+		bool ensureConnected();
+		void connectionLost();
+		void replayBaseConfiguration();
+		uint16_t parseBuffer(uint32_t num_commands);
+		void publishPass();
+		void flightFailure(const std::string& what);
+		void flightMessage(uint8_t command, uint8_t subcommand, size_t length, uint32_t value);
+		void flushFlightMessages();
+		void reserveBaseBuffers();
+		void savePartialBuffer(size_t begin);
+		void notifySample(uint8_t pin, uint32_t value);
+		void filterSample(uint8_t pin, uint32_t value);
+		std::vector<uint8_t> parse_buffer;
+		std::string string_buffer;
+		uint64_t parse_timestamp;
+		std::vector<SampleListener*> sample_listeners;
+		ShmPublisher* m_publisher;
+		bool m_publish_full;
+		FlightRecorder m_flight;
+		uint8_t flight_messages[FIRMATA_FLIGHT_BATCH * 8];
+		size_t flight_pending;
+		bool m_realtime;
 
 
 		FirmIO* m_firmIO;
-		t_pin pins[128];
+		SeqLock m_state_lock;
+
+		// Configuration replayed after a reconnect, which reads it on the parse
+		// thread while other threads send
+		std::atomic<uint8_t> configured_modes[256];
+		std::atomic<uint32_t> written_values[256];	// last value written to each pin, where written_pins is set
+		std::atomic<bool> written_pins[256];
+		std::atomic<bool> analog_reports[16];
+		std::atomic<bool> digital_reports[16];
+		std::atomic<uint32_t> sampling_interval;
+
+		uint32_t budget_baudrate;
+		double budget_headroom;
+		BudgetAction budget_action;
+
+		std::atomic<uint64_t> link_bytes;
+		std::atomic<uint64_t> link_malformed;
+		std::atomic<uint64_t> link_partial;
+
+		typedef struct s_outbound {
+			std::vector<uint8_t> bytes;
+			uint64_t queued;
+		} t_outbound;
+
+		uint8_t pin_priorities[256];
+
+		// Commands held back until the outermost endBatch(). The replay after a
+		// reconnect has its own, so it never takes over a caller's open batch.
+		typedef struct s_batch {
+			s_batch() : depth(0), urgent(false) {};
+
+			std::vector<uint8_t> bytes;
+			uint32_t depth;
+			bool urgent;
+			std::thread::id owner;
+		} t_batch;
+
+		// The batch the calling thread is filling, if any; outbound_mutex held
+		t_batch* openBatch();
+
+		// Held by whichever thread is sending, batching, pumping or reading the stats
+		std::mutex outbound_mutex;
+		t_batch user_batch;
+		t_batch replay_batch;
+		std::vector<uint8_t> sysex_buffer;
+		std::deque<t_outbound> bulk_queue;
+		uint32_t bulk_rate;
+		uint32_t bulk_burst;
+		uint32_t bulk_max_queued;
+		double bulk_tokens;
+		uint64_t bulk_refilled;
+		OutboundStats outbound_stats;
+
+		// A failed write on a sending thread marks the link down while parse()
+		// reads these, so they're atomic; reconnecting is left to the parse thread
+		bool m_auto_reconnect;
+		std::atomic<bool> m_connected;
+		std::atomic<bool> m_reconnecting;
+		uint32_t m_retry_ms;
+		std::atomic<uint64_t> m_next_attempt;
+		std::atomic<uint64_t> m_down_since;
+		std::atomic<uint32_t> m_disconnects;
+		std::mutex connection_mutex;	// guards m_connection_stats
+		ConnectionStats m_connection_stats;
+
+		// Hot state, sized from the capability response. Replaced tables are
+		// kept until destruction so lock-free readers never see freed memory.
+		typedef struct s_pin_table {
+			size_t count;
+			std::unique_ptr<t_pin_state[]> states;
+		} t_pin_table;
+
+		std::atomic<t_pin_table*> pin_table;
+		std::vector<std::unique_ptr<t_pin_table> > pin_tables;
+
+		// Cold state, only changed by init()
+		std::vector<t_pin> pins;
+		std::vector<uint16_t> analog_pins;
+
+		typedef struct s_pin_filter {
+			std::unique_ptr<FilterChain> chain;
+			std::atomic<double> value;
+		} t_pin_filter;
+
+		std::unique_ptr<t_pin_filter> pin_filters[256];
 	};
 
 }
@@ -0,0 +1,57 @@
+#ifndef __FIRMBUDGET_H__
+#define __FIRMBUDGET_H__
+
+#include <firmatacpp_export.h>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace firmata {
+
+	typedef struct I2CReport {
+		uint16_t address;
+		uint16_t reg;
+		uint32_t bytes;
+	} I2CReport;
+
+	// Everything that makes a board send data on its own, plus what the host sends back
+	typedef struct ReportConfig {
+		ReportConfig()
+			: baudrate(57600), sampling_interval_ms(19), digital_changes_per_second(10),
+			outbound_messages_per_second(0) {};
+
+		uint32_t baudrate;
+		uint32_t sampling_interval_ms;
+		std::vector<uint8_t> analog_channels;
+		std::vector<uint8_t> digital_ports;
+		std::vector<I2CReport> i2c_reports;
+		double digital_changes_per_second;	// per port; digital ports only report on change
+		double outbound_messages_per_second;	// writes such as digitalWrite and analogWrite
+	} ReportConfig;
+
+	typedef struct BandwidthEstimate {
+		double capacity;			// bytes per second in each direction, 10 bits per byte
+		double analog_in;			// bytes per second
+		double digital_in;
+		double i2c_in;
+		double inbound;
+		double outbound;
+		double inbound_utilization;
+		double outbound_utilization;
+		uint32_t setup_bytes;		// sent once to enable the reports
+	} BandwidthEstimate;
+
+	enum BudgetAction {
+		BUDGET_OFF,
+		BUDGET_WARN,	// send anyway and report the overrun on stderr
+		BUDGET_REFUSE	// don't send a report request that would overrun
+	};
+
+	FIRMATACPP_EXPORT BandwidthEstimate estimateBandwidth(const ReportConfig& config);
+	FIRMATACPP_EXPORT bool withinBudget(const BandwidthEstimate& estimate, double headroom);
+	FIRMATACPP_EXPORT std::string describeBandwidth(const BandwidthEstimate& estimate);
+
+}
+
+#endif // !__FIRMBUDGET_H__
@@ -0,0 +1,41 @@
+#ifndef __FIRMDISCOVER_H__
+#define __FIRMDISCOVER_H__
+
+#include <firmatacpp_export.h>
+#include "firmbase.h"
+#include "firmserial.h"
+
+#include <string>
+#include <vector>
+
+namespace firmata {
+
+	typedef struct DiscoveryOptions {
+		DiscoveryOptions()
+			: baudrate(57600), timeout_ms(5000), probe_interval_ms(250), firmware("") {};
+
+		uint32_t baudrate;
+		uint32_t timeout_ms;		// shared by every port, including the board's reset
+		uint32_t probe_interval_ms;	// resend probes this often until a board answers
+		std::string firmware;		// only keep boards whose firmware name contains this
+	} DiscoveryOptions;
+
+	// An open port that answered the probes. Hand serial to a board
+	// constructor along with identity to skip the handshake; the board then
+	// owns it. Otherwise delete it.
+	typedef struct DiscoveredBoard {
+		PortInfo port;
+		FirmwareIdentity identity;
+		int protocol_major_version;
+		int protocol_minor_version;
+		FirmSerial* serial;
+	} DiscoveredBoard;
+
+	// Probe every port at once with REPORT_VERSION and REPORT_FIRMWARE and
+	// return the ones running Firmata, in the order they were given
+	FIRMATACPP_EXPORT std::vector<DiscoveredBoard> discover(const DiscoveryOptions& options = DiscoveryOptions());
+	FIRMATACPP_EXPORT std::vector<DiscoveredBoard> discover(const std::vector<PortInfo>& ports, const DiscoveryOptions& options = DiscoveryOptions());
+
+}
+
+#endif // !__FIRMDISCOVER_H__
@@ -0,0 +1,112 @@
+#ifndef __FIRMENCODE_H__
+#define __FIRMENCODE_H__
+
+#include "firmata_constants.h"
+
+#include <array>
+#include <cstddef>
+#include <stdint.h>
+
+#define FIRMATA_EXTENDED_ANALOG_LEN		9 // START_SYSEX, EXTENDED_ANALOG, pin, 32 bits in 7-bit groups, END_SYSEX
+
+namespace firmata {
+
+	// Encoded fixed-length messages. Everything here is header-only and
+	// constexpr where C++11 allows, so encoding a command costs no allocation.
+	template< size_t N >
+	using Message = std::array<uint8_t, N>;
+
+	constexpr Message<1> reportVersionMessage()
+	{
+		return {{ FIRMATA_REPORT_VERSION }};
+	}
+
+	constexpr Message<3> pinModeMessage(uint8_t pin, uint8_t mode)
+	{
+		return {{ FIRMATA_SET_PIN_MODE, pin, mode }};
+	}
+
+	constexpr Message<3> digitalPinMessage(uint8_t pin, uint8_t value)
+	{
+		return {{ FIRMATA_SET_DIGITAL_PIN, pin, value }};
+	}
+
+	// pin must be below 16 and value at most FIRMATA_MAX; otherwise see writeExtendedAnalog
+	constexpr Message<3> analogMessage(uint8_t pin, uint32_t value)
+	{
+		return {{ (uint8_t)(FIRMATA_ANALOG_MESSAGE | FIRMATA_LAST_NIBBLE(pin)), (uint8_t)FIRMATA_LSB(value), (uint8_t)FIRMATA_MSB(value) }};
+	}
+
+	constexpr Message<2> reportAnalogMessage(uint8_t channel, uint8_t enable)
+	{
+		return {{ (uint8_t)(FIRMATA_REPORT_ANALOG | FIRMATA_LAST_NIBBLE(channel)), enable }};
+	}
+
+	constexpr Message<2> reportDigitalMessage(uint8_t port, uint8_t enable)
+	{
+		return {{ (uint8_t)(FIRMATA_REPORT_DIGITAL | FIRMATA_LAST_NIBBLE(port)), enable }};
+	}
+
+	// A sysex with no payload, e.g. a query
+	constexpr Message<3> sysexMessage(uint8_t command)
+	{
+		return {{ FIRMATA_START_SYSEX, command, FIRMATA_END_SYSEX }};
+	}
+
+	constexpr Message<4> sysexMessage(uint8_t command, uint8_t data)
+	{
+		return {{ FIRMATA_START_SYSEX, command, data, FIRMATA_END_SYSEX }};
+	}
+
+	// A sysex carrying one 14-bit value as an LSB/MSB pair
+	constexpr Message<5> sysexValueMessage(uint8_t command, uint32_t value)
+	{
+		return {{ FIRMATA_START_SYSEX, command, (uint8_t)FIRMATA_LSB(value), (uint8_t)FIRMATA_MSB(value), FIRMATA_END_SYSEX }};
+	}
+
+	constexpr Message<5> samplingIntervalMessage(uint32_t interval_ms)
+	{
+		return sysexValueMessage(FIRMATA_SAMPLING_INTERVAL, interval_ms);
+	}
+
+	constexpr Message<4> pinStateQueryMessage(uint8_t pin)
+	{
+		return sysexMessage(FIRMATA_PIN_STATE_QUERY, pin);
+	}
+
+	// Variable-length messages are written straight into a caller's buffer.
+	// Each returns the number of bytes written.
+
+	// START_SYSEX, command, payload as is, END_SYSEX. out must hold size + 3 bytes.
+	inline size_t writeSysex(uint8_t* out, uint8_t command, const uint8_t* payload, size_t size)
+	{
+		out[0] = FIRMATA_START_SYSEX;
+		out[1] = command;
+		for (size_t i = 0; i < size; i++) {
+			out[2 + i] = payload[i];
+		}
+		out[2 + size] = FIRMATA_END_SYSEX;
+		return size + 3;
+	}
+
+	// out must hold FIRMATA_EXTENDED_ANALOG_LEN bytes
+	inline size_t writeExtendedAnalog(uint8_t* out, uint8_t pin, uint32_t value)
+	{
+		size_t size = 0;
+		out[size++] = FIRMATA_START_SYSEX;
+		out[size++] = FIRMATA_EXTENDED_ANALOG;
+		out[size++] = pin;
+		out[size++] = FIRMATA_LSB(value);
+		out[size++] = FIRMATA_MSB(value);
+
+		// Keep sending more significant bytes until value is complete
+		for (value >>= 14; value > 0; value >>= 7) {
+			out[size++] = FIRMATA_LSB(value);
+		}
+		out[size++] = FIRMATA_END_SYSEX;
+		return size;
+	}
+
+}
+
+#endif // !__FIRMENCODE_H__
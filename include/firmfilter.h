@@ -0,0 +1,124 @@
+#ifndef __FIRMFILTER_H__
+#define __FIRMFILTER_H__
+
+#include <firmatacpp_export.h>
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+namespace firmata {
+
+	// One stage of a filter chain. update() is called once per incoming sample
+	// and returns true when the stage emits a new output.
+	class FIRMATACPP_EXPORT Filter {
+	public:
+		virtual ~Filter() {};
+		virtual bool update(double input, double& output) = 0;
+		virtual void reset() = 0;
+	};
+
+	// Exponential moving average: output += alpha * (input - output)
+	class FIRMATACPP_EXPORT EmaFilter : public Filter {
+	public:
+		EmaFilter(double alpha);
+		virtual bool update(double input, double& output) override;
+		virtual void reset() override;
+
+	private:
+		double m_alpha;
+		double m_value;
+		bool m_primed;
+	};
+
+	// Fixed-size window of the last N samples, shared by the windowed filters
+	class FIRMATACPP_EXPORT WindowFilter : public Filter {
+	public:
+		WindowFilter(uint32_t size);
+		virtual void reset() override;
+
+	protected:
+		// Push input, returning the sample that fell out of the window, if any
+		bool push(double input, double& evicted);
+
+		std::vector<double> m_window;
+		uint32_t m_size;
+		uint32_t m_count;
+		uint32_t m_next;
+		uint64_t m_total;
+	};
+
+	// Windowed mean, O(1) per sample using a running sum
+	class FIRMATACPP_EXPORT MeanFilter : public WindowFilter {
+	public:
+		MeanFilter(uint32_t size);
+		virtual bool update(double input, double& output) override;
+		virtual void reset() override;
+
+	private:
+		double m_sum;
+	};
+
+	// Windowed minimum or maximum, amortized O(1) per sample using a monotonic queue
+	class FIRMATACPP_EXPORT ExtremumFilter : public WindowFilter {
+	public:
+		ExtremumFilter(uint32_t size, bool maximum);
+		virtual bool update(double input, double& output) override;
+		virtual void reset() override;
+
+	private:
+		bool m_maximum;
+		std::vector<double> m_values;
+		std::vector<uint64_t> m_positions;
+		uint32_t m_head;
+		uint32_t m_length;
+	};
+
+	class FIRMATACPP_EXPORT MinFilter : public ExtremumFilter {
+	public:
+		MinFilter(uint32_t size) : ExtremumFilter(size, false) {};
+	};
+
+	class FIRMATACPP_EXPORT MaxFilter : public ExtremumFilter {
+	public:
+		MaxFilter(uint32_t size) : ExtremumFilter(size, true) {};
+	};
+
+	// Median of the last N samples, kept in a sorted copy of the window
+	class FIRMATACPP_EXPORT MedianFilter : public WindowFilter {
+	public:
+		MedianFilter(uint32_t size);
+		virtual bool update(double input, double& output) override;
+		virtual void reset() override;
+
+	private:
+		std::vector<double> m_sorted;
+	};
+
+	// Emit every Nth sample
+	class FIRMATACPP_EXPORT DecimateFilter : public Filter {
+	public:
+		DecimateFilter(uint32_t factor);
+		virtual bool update(double input, double& output) override;
+		virtual void reset() override;
+
+	private:
+		uint32_t m_factor;
+		uint32_t m_count;
+	};
+
+	// Stages run in the order they were added; a stage that doesn't emit
+	// stops the sample there. The chain owns its stages.
+	class FIRMATACPP_EXPORT FilterChain {
+	public:
+		FilterChain& add(Filter* filter);
+		bool update(double input, double& output);
+		void reset();
+
+	private:
+		std::vector<std::unique_ptr<Filter> > m_filters;
+	};
+
+}
+
+#endif // !__FIRMFILTER_H__
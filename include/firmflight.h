@@ -0,0 +1,121 @@
+#ifndef __FIRMFLIGHT_H__
+#define __FIRMFLIGHT_H__
+
+#include <firmatacpp_export.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Flight dump file layout (all integers little-endian):
+ *
+ *   header   "FIRMFLT1", u64 monotonic time of the dump (us), u64 wall clock (us since epoch),
+ *            u32 reason length, reason, u32 entry count
+ *   entry*   u64 timestamp (monotonic us), u8 type, u8 flags, u16 reserved, u32 size, payload
+ *
+ * FLIGHT_RX and FLIGHT_TX entries hold raw bytes read from and written to the
+ * board. FLIGHT_MESSAGES entries hold 8 byte message headers, see
+ * FlightMessage. FLIGHT_EVENT entries hold text, e.g. what timed out.
+ */
+
+#define FIRMATA_FLIGHT_SLOTS		1024 // default ring size, 64 bytes a slot
+#define FIRMATA_FLIGHT_SLOT_BYTES	40 // payload bytes per slot
+#define FIRMATA_FLIGHT_MAX_CHUNK	4096 // longer reads and writes keep their first bytes
+#define FIRMATA_FLIGHT_TRUNCATED	0x01 // entry flag: the chunk was longer than recorded
+#define FIRMATA_FLIGHT_BATCH		64 // message headers Base batches into one entry
+
+namespace firmata {
+
+	enum FlightEntryType {
+		FLIGHT_RX = 1,
+		FLIGHT_TX,
+		FLIGHT_MESSAGES,
+		FLIGHT_EVENT
+	};
+
+	// Header of a parsed message. command 0 marks bytes skipped while
+	// resynchronizing: subcommand is the first of them and length their count.
+	typedef struct FlightMessage {
+		uint8_t command;	// status byte
+		uint8_t subcommand;	// sysex command, if command is START_SYSEX
+		uint16_t length;	// sysex payload bytes
+		uint32_t value;		// analog or digital value
+	} FlightMessage;
+
+	typedef struct FlightEntry {
+		uint64_t timestamp;
+		uint8_t type;
+		uint8_t flags;
+		std::vector<uint8_t> bytes;
+
+		std::vector<FlightMessage> messages() const;
+	} FlightEntry;
+
+	// Fixed-size ring of the most recent raw I/O and message headers. Recording
+	// is lock-free and allocation-free, safe from the parse thread and any
+	// sending threads at once; dumping copies out whatever is complete.
+	class FIRMATACPP_EXPORT FlightRecorder {
+	public:
+		FlightRecorder(uint32_t slots = FIRMATA_FLIGHT_SLOTS);
+
+		void record(FlightEntryType type, uint64_t timestamp, const uint8_t* bytes, size_t size);
+		void recordEvent(const std::string& text);
+		uint64_t recorded();
+
+		// Automatic dumps go to <prefix>-<wall clock ms>-<n>.flight, at most max_dumps of them.
+		// Dumps requested before a prefix is set are written as soon as one is.
+		void setDumpPrefix(const std::string& prefix, uint32_t max_dumps = 16);
+		// Returns the file written, or "" if there is no prefix or max_dumps is reached
+		std::string dump(const std::string& reason);
+		bool dumpTo(const std::string& path, const std::string& reason);
+
+		std::vector<FlightEntry> entries();
+
+	private:
+		FlightRecorder(const FlightRecorder&);
+		FlightRecorder& operator=(const FlightRecorder&);
+
+		typedef struct s_flight_slot {
+			std::atomic<uint64_t> sequence;		// 2 * index + 1 while written, 2 * index + 2 once complete
+			std::atomic<uint64_t> timestamp;
+			std::atomic<uint64_t> header;		// type, flags, piece size, piece offset, chunk size
+			std::atomic<uint64_t> data[FIRMATA_FLIGHT_SLOT_BYTES / 8];
+		} t_flight_slot;
+
+		std::unique_ptr<t_flight_slot[]> m_slots;
+		uint64_t m_mask;
+		std::atomic<uint64_t> m_head;
+
+		std::mutex m_dump_mutex;
+		std::string m_prefix;
+		uint32_t m_max_dumps;
+		uint32_t m_dumps;
+		std::vector<std::string> m_pending;
+	};
+
+	// Loads a flight dump
+	class FIRMATACPP_EXPORT FlightDump {
+	public:
+		FlightDump(const std::string& path);
+
+		bool isOpen();
+		uint64_t dumpTime();		// monotonic clock when dumped
+		uint64_t dumpWallTime();	// wall clock when dumped
+		const std::string& reason();
+		const std::vector<FlightEntry>& entries();
+
+	private:
+		bool m_open;
+		uint64_t m_dump_time;
+		uint64_t m_dump_wall_time;
+		std::string m_reason;
+		std::vector<FlightEntry> m_entries;
+	};
+
+}
+
+#endif // !__FIRMFLIGHT_H__
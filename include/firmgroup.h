@@ -0,0 +1,148 @@
+#ifndef __FIRMGROUP_H__
+#define __FIRMGROUP_H__
+
+#include <firmatacpp_export.h>
+#include "firmbase.h"
+#include "firmstate.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FIRMATA_GROUP_HISTORY	8 // samples kept per channel for alignment
+#define FIRMATA_GROUP_NO_CHANNEL	((size_t)-1) // subscribe() refused the channel
+
+namespace firmata {
+
+	enum AlignMode {
+		ALIGN_LATEST,		// each channel's latest sample at or before the frame time
+		ALIGN_INTERPOLATE	// linear between the samples either side of the frame time
+	};
+
+	typedef struct SamplingGroupConfig {
+		SamplingGroupConfig()
+			: rate_hz(50), mode(ALIGN_LATEST), delay_us(40000), stale_us(100000), queue_frames(256) {};
+
+		double rate_hz;			// frames per second
+		AlignMode mode;
+		uint64_t delay_us;		// build each frame this long after its time, so samples up to
+								// then can arrive; interpolation needs at least one sampling interval
+		uint64_t stale_us;		// a channel is stale in a frame if its sample is older than this
+		uint32_t queue_frames;	// frames waiting for the consumer; the oldest are dropped past this
+	} SamplingGroupConfig;
+
+	// One instant across every subscribed channel
+	typedef struct AlignedFrame {
+		uint64_t sequence;
+		uint64_t timestamp;			// monotonicMicros() the values are aligned to
+		std::vector<double> values;	// one per channel in subscription order; NaN before any sample
+		std::vector<uint8_t> stale;	// 1 where the channel's sample is older than stale_us
+	} AlignedFrame;
+
+	typedef struct GroupBoardStats {
+		uint64_t samples;			// samples received on subscribed channels
+		double skew_us;				// mean of frame time minus the time of the sample used
+		uint64_t max_skew_us;
+		uint64_t staleness_us;		// age of the board's newest sample when the last frame was built
+		uint64_t max_staleness_us;
+		uint64_t stale_frames;		// frames with at least one of the board's channels stale
+	} GroupBoardStats;
+
+	typedef struct GroupStats {
+		uint64_t frames;
+		uint64_t dropped_frames;	// overwritten before the consumer took them
+		std::vector<GroupBoardStats> boards;	// in the order boards were first subscribed
+	} GroupStats;
+
+	// Aligns samples from several boards onto one clock. Samples are timestamped
+	// by each board's parse() on the shared monotonic clock; a background thread
+	// builds a frame at every tick of the output rate and queues it for a single
+	// consumer.
+	class FIRMATACPP_EXPORT SamplingGroup {
+	public:
+		SamplingGroup(const SamplingGroupConfig& config = SamplingGroupConfig());
+		// Stop parsing every subscribed board first; the boards must outlive the group
+		~SamplingGroup();
+
+		// Subscribe before the boards start parsing. Returns the channel's index in frames,
+		// or FIRMATA_GROUP_NO_CHANNEL once the group has started or if channel isn't mapped.
+		size_t subscribe(Base* board, uint8_t pin);
+		size_t subscribe(Base* board, AnalogChannel channel);
+		size_t channels();
+
+		void start();
+		void stop();
+
+		// Wait up to timeout_ms for the next frame; false if none arrived
+		bool nextFrame(AlignedFrame& frame, uint32_t timeout_ms = 1000);
+		GroupStats stats();
+
+	private:
+		SamplingGroup(const SamplingGroup&);
+		SamplingGroup& operator=(const SamplingGroup&);
+
+		typedef struct s_group_channel {
+			size_t board;
+			uint8_t pin;
+			std::atomic<uint32_t> count;
+			std::atomic<uint64_t> timestamps[FIRMATA_GROUP_HISTORY];
+			std::atomic<uint32_t> values[FIRMATA_GROUP_HISTORY];
+		} t_group_channel;
+
+		class BoardListener : public SampleListener {
+		public:
+			BoardListener(SamplingGroup* group, size_t board) : m_group(group), m_board(board) {};
+			virtual void onSample(uint8_t pin, uint32_t value, uint64_t timestamp) override;
+
+		private:
+			SamplingGroup* m_group;
+			size_t m_board;
+		};
+
+		typedef struct s_group_board {
+			Base* board;
+			std::unique_ptr<BoardListener> listener;
+			int16_t channel_of[256];	// pin to channel index, -1 if not subscribed
+			SeqLock lock;
+			std::atomic<uint64_t> newest;
+			std::atomic<uint64_t> samples;
+			GroupBoardStats stats;
+			uint64_t aligned_frames;
+		} t_group_board;
+
+		typedef struct s_history {
+			uint32_t count;
+			uint64_t timestamps[FIRMATA_GROUP_HISTORY];
+			uint32_t values[FIRMATA_GROUP_HISTORY];
+		} t_history;
+
+		void record(size_t board, uint8_t pin, uint32_t value, uint64_t timestamp);
+		void frameLoop();
+		void buildFrame(uint64_t timestamp);
+		double align(const t_history& history, uint64_t timestamp, uint64_t& sample_time);
+
+		SamplingGroupConfig m_config;
+		std::vector<std::unique_ptr<t_group_board>> m_boards;
+		std::vector<std::unique_ptr<t_group_channel>> m_channels;
+
+		// Frame thread only
+		std::vector<t_history> m_history;
+		AlignedFrame m_building;
+
+		std::mutex m_mutex;
+		std::condition_variable m_frame_ready;
+		std::condition_variable m_wake;
+		std::vector<AlignedFrame> m_queue;
+		size_t m_queue_head;
+		size_t m_queue_size;
+		uint64_t m_frames;
+		uint64_t m_dropped;
+		bool m_running;
+		std::thread m_thread;
+	};
+
+}
+
+#endif // !__FIRMGROUP_H__
@@ -4,7 +4,11 @@
 #include <firmatacpp_export.h>
 #include "firmata_constants.h"
 #include "firmbase.h"
+#include "firmencode.h"
+#include "firmfilter.h"
 #include "firmio.h"
+#include "firmpack.h"
+#include "firmstate.h"
 
 #define FIRMATA_I2C_REQUEST	0x76
 #define FIRMATA_I2C_REPLY	0x77
@@ -19,27 +23,125 @@
 
 #define FIRMATA_I2C_REGISTER_NOT_SPECIFIED 0x00
 
+#define FIRMATA_I2C_MAX_SLOTS		64 // distinct address/register pairs tracked; replies for more are dropped
+#define FIRMATA_I2C_MAX_REPLY		64 // reply bytes kept per address/register pair; the rest are cut off
+
 namespace firmata {
 
+	// mode is one of FIRMATA_I2C_WRITE, READ_ONCE, READ_CONTINUOUS or STOP_READING
+	constexpr uint8_t i2cAddressMsb(uint16_t address, uint8_t mode)
+	{
+		return (uint8_t)(FIRMATA_MSB(address) ? FIRMATA_MSB(address) | FIRMATA_I2C_10_BIT | mode : mode);
+	}
+
+	constexpr Message<5> i2cConfigMessage(uint32_t delay)
+	{
+		return sysexValueMessage(FIRMATA_I2C_CONFIG, delay);
+	}
+
+	constexpr Message<7> i2cRequestMessage(uint16_t address, uint8_t mode, uint32_t bytes)
+	{
+		return {{ FIRMATA_START_SYSEX, FIRMATA_I2C_REQUEST, (uint8_t)FIRMATA_LSB(address), i2cAddressMsb(address, mode),
+			(uint8_t)FIRMATA_LSB(bytes), (uint8_t)FIRMATA_MSB(bytes), FIRMATA_END_SYSEX }};
+	}
+
+	constexpr Message<9> i2cRequestMessage(uint16_t address, uint16_t reg, uint8_t mode, uint32_t bytes)
+	{
+		return {{ FIRMATA_START_SYSEX, FIRMATA_I2C_REQUEST, (uint8_t)FIRMATA_LSB(address), i2cAddressMsb(address, mode),
+			(uint8_t)FIRMATA_LSB(reg), (uint8_t)FIRMATA_MSB(reg), (uint8_t)FIRMATA_LSB(bytes), (uint8_t)FIRMATA_MSB(bytes), FIRMATA_END_SYSEX }};
+	}
+
+	// An I2C write of data to address. out must hold 2 * size + 5 bytes; returns the bytes written.
+	inline size_t writeI2CWrite(uint8_t* out, uint16_t address, const uint8_t* data, size_t size)
+	{
+		out[0] = FIRMATA_START_SYSEX;
+		out[1] = FIRMATA_I2C_REQUEST;
+		out[2] = FIRMATA_LSB(address);
+		out[3] = i2cAddressMsb(address, FIRMATA_I2C_WRITE);
+		size_t pairs = encode7BitPairs(data, size, out + 4);
+		out[4 + pairs] = FIRMATA_END_SYSEX;
+		return pairs + 5;
+	}
+
+	// Where a numeric value sits in an I2C reply, for filtering
+	typedef struct I2CValue {
+		I2CValue(uint8_t offset = 0, uint8_t width = 2, bool big_endian = true, bool is_signed = false)
+			: offset(offset), width(width), big_endian(big_endian), is_signed(is_signed) {};
+
+		uint8_t offset;		// first byte of the value in the reply
+		uint8_t width;		// 1 to 4 bytes
+		bool big_endian;
+		bool is_signed;
+	} I2CValue;
+
+	// Replies that didn't fit the fixed reply storage; readable from any thread
+	typedef struct I2CStats {
+		uint64_t truncated_replies;	// longer than FIRMATA_I2C_MAX_REPLY, kept cut short
+		uint64_t dropped_replies;	// for a pair beyond FIRMATA_I2C_MAX_SLOTS, not kept at all
+	} I2CStats;
+
 	class FIRMATACPP_EXPORT I2C : virtual Base {
 	public:
 		I2C(FirmIO *firmIO);
+		I2C(FirmIO *firmIO, const FirmwareIdentity& identity);
 		virtual ~I2C();
 
 		void configI2C(uint32_t delay);
-		void reportI2C(uint16_t address, uint16_t reg, uint32_t bytes);
+		// Returns false if the bandwidth budget refused the request, or if
+		// FIRMATA_I2C_MAX_SLOTS pairs are already tracked
+		bool reportI2C(uint16_t address, uint16_t reg, uint32_t bytes);
+		// The latest reply, at most FIRMATA_I2C_MAX_REPLY bytes; i2cStats() counts
+		// replies that were longer
 		std::vector<uint8_t> readI2C(uint16_t address, uint16_t reg = 0);
+		size_t readI2C(uint16_t address, uint16_t reg, uint8_t* buffer, size_t size);
+		// At most FIRMATA_I2C_MAX_REPLY bytes, as readI2C()
 		std::vector<uint8_t> readI2COnce(uint16_t address, uint16_t reg, uint32_t bytes);
 		void writeI2C(uint16_t address, std::vector<uint8_t> data);
+		void writeI2C(uint16_t address, const uint8_t* data, size_t size);
+
+		// Run the value in each continuous reply through a filter chain inside parse().
+		// I2C takes ownership; set filters before parsing starts. NULL removes it.
+		void filterI2C(uint16_t address, uint16_t reg, FilterChain* filter, const I2CValue& value = I2CValue());
+		// Latest filter output, or 0 if nothing has been filtered yet
+		double readI2CFiltered(uint16_t address, uint16_t reg = 0);
+
+		I2CStats i2cStats();
 
 	protected:
-		virtual bool handleSysex(uint8_t command, std::vector<uint8_t> data);
-		virtual bool handleString(std::string data);
+		virtual bool handleSysex(uint8_t command, ByteView data);
+		virtual bool handleString(StringView data);
+		virtual void replayConfiguration();
+		virtual void describeReports(ReportConfig& config);
+		virtual void publishState(ShmPublisher& publisher, bool full);
+		virtual void reserveBuffers();
 
 	private:
+		// Latest reply for one address/register pair. Claimed once and never
+		// released, so readers can look slots up without locking.
+		typedef struct s_i2c_slot {
+			std::atomic<uint32_t>	key;
+			std::atomic<bool>		reporting;
+			uint32_t				report_bytes;
+			bool					published;	// parse thread only
+			SeqLock					lock;
+			std::atomic<uint8_t>	length;
+			std::atomic<uint8_t>	bytes[FIRMATA_I2C_MAX_REPLY];
+			std::unique_ptr<FilterChain> filter;
+			I2CValue				value;
+			std::atomic<double>		filtered;
+		} t_i2c_slot;
+
+		void initSlots();
+		t_i2c_slot* findSlot(uint16_t address, uint16_t reg, bool create);
+		size_t copyReply(t_i2c_slot* slot, uint8_t* buffer, size_t size);
+		void filterReply(t_i2c_slot* slot, const uint8_t* reply, size_t length);
+
 		uint32_t m_delay;
-		bool reporting[1024][1024];
-		std::vector<uint8_t> values[1024][1024];
+		bool m_configured;
+		std::vector<uint8_t> m_write_buffer;
+		t_i2c_slot m_slots[FIRMATA_I2C_MAX_SLOTS];
+		std::atomic<uint64_t> m_truncated;
+		std::atomic<uint64_t> m_dropped;
 	};
 
 }
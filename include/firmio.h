@@ -4,17 +4,34 @@
 #include "firmata_constants.h"
 
 #include <cstddef>
+#include <cstring>
 
 namespace firmata {
 
+	// Transport errors must be thrown as IOException or NotOpenException, which
+	// parse() and the writers turn into a reconnect and a flight dump. That
+	// includes available(), which parse() calls in real-time mode.
 	class FirmIO{
 	public:
+		virtual ~FirmIO() {};
 		virtual void open() = 0;
 		virtual bool isOpen() = 0;
 		virtual void close() = 0;
 		virtual size_t available() = 0;
 		virtual std::vector<uint8_t> read(size_t size = 1) = 0;
+		// Read into a caller-owned buffer; override to avoid the per-read vector
+		virtual size_t read(uint8_t* buffer, size_t size)
+		{
+			std::vector<uint8_t> bytes = read(size);
+			if (bytes.size()) memcpy(buffer, bytes.data(), bytes.size());
+			return bytes.size();
+		}
 		virtual size_t write(std::vector<uint8_t> bytes) = 0;
+		// Write from a caller-owned buffer; override to avoid the per-write vector
+		virtual size_t write(const uint8_t* bytes, size_t size)
+		{
+			return write(std::vector<uint8_t>(bytes, bytes + size));
+		}
 	};
 
 	class IOException : public std::exception {
@@ -0,0 +1,27 @@
+#ifndef __FIRMPACK_H__
+#define __FIRMPACK_H__
+
+#include <firmatacpp_export.h>
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace firmata {
+
+	// Split each byte into an LSB/MSB pair of 7-bit bytes. out must hold 2 * size bytes.
+	// Returns the number of bytes written.
+	FIRMATACPP_EXPORT size_t encode7BitPairs(const uint8_t* bytes, size_t size, uint8_t* out);
+
+	// Combine LSB/MSB pairs of 7-bit bytes back into bytes. A trailing unpaired
+	// byte is ignored. out must hold size / 2 bytes. Returns the number of bytes written.
+	FIRMATACPP_EXPORT size_t decode7BitPairs(const uint8_t* pairs, size_t size, uint8_t* out);
+
+	// First FIRMATA_END_SYSEX in [begin, end), or end if there is none
+	FIRMATACPP_EXPORT const uint8_t* findEndSysex(const uint8_t* begin, const uint8_t* end);
+
+	// First byte with the high bit set (a MIDI status byte) in [begin, end), or end
+	FIRMATACPP_EXPORT const uint8_t* findStatusByte(const uint8_t* begin, const uint8_t* end);
+
+}
+
+#endif // !__FIRMPACK_H__
@@ -0,0 +1,37 @@
+#ifndef __FIRMREALTIME_H__
+#define __FIRMREALTIME_H__
+
+#include <firmatacpp_export.h>
+
+#include <stdint.h>
+
+#define FIRMATA_RT_STACK_PREFAULT	(64 * 1024) // stack touched after locking memory
+
+namespace firmata {
+
+	typedef struct RealtimeConfig {
+		RealtimeConfig()
+			: cpu(-1), priority(0), lock_memory(true) {};
+
+		int cpu;			// pin the I/O thread to this CPU; -1 leaves it where it is
+		int priority;		// SCHED_FIFO priority, 1-99; 0 keeps the current policy
+		bool lock_memory;	// lock current and future pages so the I/O thread never faults
+	} RealtimeConfig;
+
+	// What was applied; steps that weren't asked for are false
+	typedef struct RealtimeStatus {
+		bool preallocated;
+		bool pinned;
+		bool scheduled;
+		bool locked;
+		int error;			// errno from the first step that failed, 0 if none did
+	} RealtimeStatus;
+
+	// Pins, schedules and locks memory for the calling thread. Needs
+	// CAP_SYS_NICE for SCHED_FIFO and CAP_IPC_LOCK (or RLIMIT_MEMLOCK) to lock;
+	// without them the step fails and the rest still runs.
+	FIRMATACPP_EXPORT RealtimeStatus applyRealtime(const RealtimeConfig& config);
+
+}
+
+#endif // !__FIRMREALTIME_H__
@@ -0,0 +1,174 @@
+#ifndef __FIRMRECORD_H__
+#define __FIRMRECORD_H__
+
+#include <firmatacpp_export.h>
+#include "firmstate.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Recording file layout (all integers little-endian):
+ *
+ *   header   "FIRMREC1", u64 monotonic start (us), u64 wall clock start (us since epoch)
+ *   block*   u32 type, u8 pin, u8 reserved[3], u32 count, u32 payload size,
+ *            u64 first timestamp, u64 last timestamp, u32 first value,
+ *            u32 timestamp column size, payload
+ *   footer   u32 FIRMATA_RECORD_FOOTER, u64 offset of the last index block
+ *
+ * A data block holds one pin's samples as two columns: varint timestamp
+ * deltas, then zigzag varint value deltas, each relative to the previous
+ * sample. An index block lists the blocks written since the previous index
+ * as (u64 offset, u64 first, u64 last, u32 count, u8 pin, u8 reserved[3]),
+ * after a u64 offset of the previous index block.
+ * Files cut short by a crash have no footer and are read by scanning blocks.
+ */
+
+#define FIRMATA_RECORD_DATA		0x31544144 // "DAT1"
+#define FIRMATA_RECORD_INDEX	0x31584449 // "IDX1"
+#define FIRMATA_RECORD_FOOTER	0x31444E45 // "END1"
+
+namespace firmata {
+
+	typedef struct RecordedSample {
+		uint64_t timestamp;
+		uint32_t value;
+	} RecordedSample;
+
+	typedef struct RecorderConfig {
+		RecorderConfig()
+			: block_samples(4096), block_span_us(10000000), max_pending_blocks(64),
+			index_interval(64), flush_interval_ms(1000) {};
+
+		uint32_t block_samples;		// seal a pin's block after this many samples...
+		uint64_t block_span_us;		// ...or once it spans this long
+		uint32_t max_pending_blocks;	// sealed blocks waiting for disk; more are dropped
+		uint32_t index_interval;	// write an index block every N data blocks
+		uint32_t flush_interval_ms;	// flush to disk at least this often
+	} RecorderConfig;
+
+	typedef struct RecorderStats {
+		uint64_t samples;
+		uint64_t dropped_samples;
+		uint64_t blocks_written;
+		uint64_t bytes_written;
+	} RecorderStats;
+
+	// Streams samples from the parser to a delta-compressed columnar file.
+	// Memory is bounded by block_samples and max_pending_blocks; disk writes
+	// happen on a background thread.
+	class FIRMATACPP_EXPORT Recorder : public SampleListener {
+	public:
+		Recorder(const std::string& path, const RecorderConfig& config = RecorderConfig());
+		virtual ~Recorder();
+
+		bool isOpen();
+
+		// Record only these pins. With none added, every sample is recorded.
+		void addPin(uint8_t pin);
+
+		virtual void onSample(uint8_t pin, uint32_t value, uint64_t timestamp) override;
+
+		// Wait until every sealed block is on disk
+		void flush();
+		// Seal open blocks and write the final index; call once parsing has stopped
+		void close();
+
+		RecorderStats stats();
+
+	private:
+		typedef struct s_block {
+			uint8_t pin;
+			uint32_t count;
+			uint64_t first_timestamp;
+			uint64_t last_timestamp;
+			uint32_t first_value;
+			uint32_t last_value;
+			std::vector<uint8_t> timestamps;
+			std::vector<uint8_t> values;
+		} t_block;
+
+		typedef struct s_index_entry {
+			uint64_t offset;
+			uint64_t first_timestamp;
+			uint64_t last_timestamp;
+			uint32_t count;
+			uint8_t pin;
+		} t_index_entry;
+
+		t_block* openBlock(uint8_t pin);
+		void resetBlock(t_block* block, uint8_t pin);
+		void seal(uint8_t pin, bool force);
+		void writerLoop();
+		void writeBlock(t_block* block);
+		void writeIndex();
+
+		RecorderConfig m_config;
+		FILE* m_file;
+		uint64_t m_offset;
+		bool m_filter;
+		bool m_recording[256];
+		std::atomic<uint64_t> m_samples;
+		std::unique_ptr<t_block> m_open[256];
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_drained;
+		std::deque<std::unique_ptr<t_block> > m_pending;
+		std::vector<std::unique_ptr<t_block> > m_free;
+		bool m_writing;
+		bool m_stop;
+		std::thread m_writer;
+
+		std::vector<t_index_entry> m_index;
+		uint64_t m_last_index;
+		RecorderStats m_stats;
+	};
+
+	// Reads a recording, memory-mapped where the platform allows
+	class FIRMATACPP_EXPORT RecordingReader {
+	public:
+		RecordingReader(const std::string& path);
+		~RecordingReader();
+
+		bool isOpen();
+		uint64_t startTime();		// monotonic clock at recording start
+		uint64_t startWallTime();	// wall clock at recording start
+
+		std::vector<uint8_t> pins();
+		uint64_t firstTimestamp(uint8_t pin);
+		uint64_t lastTimestamp(uint8_t pin);
+
+		// Append samples of pin with begin <= timestamp < end
+		size_t read(uint8_t pin, uint64_t begin, uint64_t end, std::vector<RecordedSample>& samples);
+		// Latest sample at or before timestamp
+		bool valueAt(uint8_t pin, uint64_t timestamp, RecordedSample& sample);
+
+	private:
+		typedef struct s_block_ref {
+			uint64_t offset;
+			uint64_t first_timestamp;
+			uint64_t last_timestamp;
+			uint32_t count;
+		} t_block_ref;
+
+		bool loadIndex();
+		void scanBlocks();
+		void addBlock(uint8_t pin, const t_block_ref& ref);
+		size_t decode(const t_block_ref& ref, uint64_t begin, uint64_t end, std::vector<RecordedSample>& samples);
+
+		const uint8_t* m_data;
+		size_t m_size;
+		std::vector<uint8_t> m_buffer;
+		std::vector<t_block_ref> m_blocks[256];
+	};
+
+}
+
+#endif // !__FIRMRECORD_H__
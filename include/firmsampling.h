@@ -0,0 +1,64 @@
+#ifndef __FIRMSAMPLING_H__
+#define __FIRMSAMPLING_H__
+
+#include <firmatacpp_export.h>
+#include "firmbase.h"
+
+#include <deque>
+#include <vector>
+
+#define FIRMATA_SAMPLING_DECISIONS	64 // decisions kept by a SamplingController
+
+namespace firmata {
+
+	typedef struct SamplingControllerConfig {
+		SamplingControllerConfig()
+			: baudrate(57600), target_utilization(0.6), deadband(0.1), min_interval_ms(10),
+			max_interval_ms(1000), update_interval_ms(1000), max_malformed_rate(0.001) {};
+
+		uint32_t baudrate;			// the UART sends 10 bits per byte
+		double target_utilization;	// fraction of the link the board should use
+		double deadband;			// leave the interval alone within target * (1 +- deadband)
+		uint32_t min_interval_ms;
+		uint32_t max_interval_ms;
+		uint32_t update_interval_ms;	// how much traffic each decision is based on
+		double max_malformed_rate;	// malformed messages per byte that force a back off
+	} SamplingControllerConfig;
+
+	typedef struct SamplingDecision {
+		uint64_t timestamp;			// monotonicMicros()
+		double utilization;
+		double malformed_rate;
+		uint32_t old_interval_ms;
+		uint32_t new_interval_ms;
+		const char* reason;
+	} SamplingDecision;
+
+	// Moves the board's sampling interval toward a target share of the link.
+	// Incoming bytes scale with 1 / interval, so each step rescales the
+	// interval by measured / target utilization, at most halving or doubling it.
+	class FIRMATACPP_EXPORT SamplingController {
+	public:
+		SamplingController(Base* board, const SamplingControllerConfig& config = SamplingControllerConfig());
+
+		// Call regularly from the thread that calls parse(); returns true if the interval changed
+		bool update();
+
+		uint32_t interval();
+		double utilization();
+		std::vector<SamplingDecision> decisions();
+
+	private:
+		void decide(uint64_t now, double malformed_rate, uint32_t current, uint32_t interval, const char* reason);
+
+		Base* m_board;
+		SamplingControllerConfig m_config;
+		uint64_t m_last_update;
+		LinkStats m_last_stats;
+		double m_utilization;
+		std::deque<SamplingDecision> m_decisions;
+	};
+
+}
+
+#endif // !__FIRMSAMPLING_H__
@@ -14,8 +14,9 @@ namespace firmata {
 
 	class FirmSerial : public FirmIO {
 	public:
+		// Waits up to open_timeout ms for the board to come out of reset; 0 doesn't wait
 		FirmSerial(const std::string &port = "",
-			uint32_t baudrate = 57600);
+			uint32_t baudrate = 57600, uint32_t open_timeout = 5000);
 		~FirmSerial();
 
 		virtual void open() override;
@@ -23,7 +24,9 @@ namespace firmata {
 		virtual void close() override;
 		virtual size_t available() override;
 		virtual std::vector<uint8_t> read(size_t size = 1) override;
+		virtual size_t read(uint8_t* buffer, size_t size) override;
 		virtual size_t write(std::vector<uint8_t> bytes) override;
+		virtual size_t write(const uint8_t* bytes, size_t size) override;
 
 		static std::vector<PortInfo> listPorts();
 
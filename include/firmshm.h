@@ -0,0 +1,121 @@
+#ifndef __FIRMSHM_H__
+#define __FIRMSHM_H__
+
+#include <firmatacpp_export.h>
+#include "firmata_constants.h"
+#include "firmstate.h"
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#define FIRMATA_SHM_MAGIC		0x4D485346 // "FSHM"
+#define FIRMATA_SHM_VERSION		1
+#define FIRMATA_SHM_PINS		128 // pins past this aren't published; see ShmPublisher::droppedPins()
+#define FIRMATA_SHM_NAME_LEN	64
+#define FIRMATA_SHM_I2C_SLOTS	64
+#define FIRMATA_SHM_I2C_REPLY	64
+#define FIRMATA_SHM_WAIT_US		100000 // clients give up on a pass left open this long
+
+namespace firmata {
+
+	// Layout of the shared memory segment. Written by one publisher under the
+	// sequence count, read by any number of processes. Only lock-free atomics,
+	// so it means the same thing in every process that maps it.
+	typedef struct SharedState {
+		std::atomic<uint32_t> magic;		// set last, once the segment is initialised
+		uint32_t version;
+		std::atomic<uint32_t> sequence;		// odd while a parse pass is being published
+		std::atomic<uint64_t> updated;		// monotonicMicros() of the last pass
+		std::atomic<uint32_t> publisher_pid;
+
+		std::atomic<int32_t> major_version;
+		std::atomic<int32_t> minor_version;
+		std::atomic<uint8_t> name[FIRMATA_SHM_NAME_LEN];
+
+		std::atomic<uint32_t> pin_count;
+		std::atomic<uint8_t> modes[FIRMATA_SHM_PINS];
+		std::atomic<uint32_t> values[FIRMATA_SHM_PINS];
+
+		// Keys are 0x80000000 | address << 16 | register, 0 for a free slot
+		std::atomic<uint32_t> i2c_keys[FIRMATA_SHM_I2C_SLOTS];
+		std::atomic<uint8_t> i2c_lengths[FIRMATA_SHM_I2C_SLOTS];
+		std::atomic<uint8_t> i2c_bytes[FIRMATA_SHM_I2C_SLOTS][FIRMATA_SHM_I2C_REPLY];
+	} SharedState;
+
+	// Atomics that take a lock would lock only within one process
+	static_assert(ATOMIC_CHAR_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+		"SharedState needs lock-free atomics to be shared between processes");
+	static_assert(sizeof(std::atomic<uint8_t>) == 1 && sizeof(std::atomic<uint32_t>) == 4 && sizeof(std::atomic<uint64_t>) == 8,
+		"SharedState must have the same layout in every process");
+
+	// Creates a named POSIX shared memory segment and writes board state into
+	// it. Attach with Base::publish(); the board writes it from parse().
+	class FIRMATACPP_EXPORT ShmPublisher {
+	public:
+		// Takes over a segment left by a process that has exited, but not one
+		// a live publisher owns; isOpen() is false then
+		ShmPublisher(const std::string& name);
+		~ShmPublisher();
+
+		bool isOpen();
+		// Pins past FIRMATA_SHM_PINS left out of the last pass
+		size_t droppedPins();
+
+		// Writer side, called from the parse thread between begin() and end()
+		void begin();
+		void end();
+		void setIdentity(const std::string& name, int major_version, int minor_version);
+		void setPins(size_t count, const t_pin_state* states);
+		void setI2C(uint32_t key, const uint8_t* bytes, size_t size);
+
+	private:
+		ShmPublisher(const ShmPublisher&);
+		ShmPublisher& operator=(const ShmPublisher&);
+
+		std::string m_name;
+		SharedState* m_state;
+		size_t m_dropped_pins;
+	};
+
+	// Maps a published segment read-only. Reads go straight to shared memory
+	// and retry while the publisher is mid-pass, for up to FIRMATA_SHM_WAIT_US;
+	// then they return nothing, as if the value had never been published.
+	class FIRMATACPP_EXPORT ShmClient {
+	public:
+		ShmClient(const std::string& name);
+		~ShmClient();
+
+		// False once the publisher closes, or a read finds it died mid-pass
+		bool isOpen();
+		// The publisher has exited, or left a pass half written and died
+		bool stale();
+		uint64_t updated();
+
+		std::string firmwareName();
+		int majorVersion();
+		int minorVersion();
+
+		size_t pinCount();
+		uint8_t pinMode(uint8_t pin);
+		uint32_t read(uint8_t pin);
+		void snapshot(Snapshot& snapshot);
+
+		// Latest I2C reply for address/register, 0 if none has been published
+		size_t readI2C(uint16_t address, uint16_t reg, uint8_t* buffer, size_t size);
+
+	private:
+		ShmClient(const ShmClient&);
+		ShmClient& operator=(const ShmClient&);
+
+		bool readBegin(uint32_t& sequence);
+		bool readRetry(uint32_t sequence);
+		bool publisherAlive();
+
+		const SharedState* m_state;
+		bool m_stale;
+	};
+
+}
+
+#endif // !__FIRMSHM_H__
@@ -0,0 +1,92 @@
+#ifndef __FIRMSTATE_H__
+#define __FIRMSTATE_H__
+
+#include <firmatacpp_export.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace firmata {
+
+	// Microseconds on the monotonic clock shared by every board in the process
+	inline uint64_t monotonicMicros()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Sequence lock for state written by a single parser thread and read by any
+	// number of reader threads. The writer never waits; readers retry if a
+	// write pass overlapped their read. A read on the writing thread, from a
+	// callback inside the pass, returns at once with the pass so far.
+	class SeqLock {
+	public:
+		SeqLock() : m_sequence(0) {};
+
+		void writeBegin()
+		{
+			// Published by the release store, for readers that see the odd sequence
+			m_writer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+			m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		void writeEnd()
+		{
+			m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		uint32_t readBegin() const
+		{
+			uint32_t sequence;
+			while ((sequence = m_sequence.load(std::memory_order_acquire)) & 1) {
+				if (m_writer.load(std::memory_order_relaxed) == std::this_thread::get_id()) break;
+				std::this_thread::yield();
+			}
+			return sequence;
+		}
+
+		bool readRetry(uint32_t sequence) const
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return m_sequence.load(std::memory_order_relaxed) != sequence;
+		}
+
+	private:
+		std::atomic<uint32_t> m_sequence;
+		std::atomic<std::thread::id> m_writer;
+	};
+
+	class SeqLockWriter {
+	public:
+		SeqLockWriter(SeqLock& lock) : m_lock(lock) { m_lock.writeBegin(); };
+		~SeqLockWriter() { m_lock.writeEnd(); };
+
+	private:
+		SeqLockWriter(const SeqLockWriter&);
+		SeqLockWriter& operator=(const SeqLockWriter&);
+
+		SeqLock& m_lock;
+	};
+
+	// Receives each analog or digital input value as the parser stores it.
+	// Called on the parser thread, so implementations must not block.
+	class SampleListener {
+	public:
+		virtual ~SampleListener() {};
+		virtual void onSample(uint8_t pin, uint32_t value, uint64_t timestamp) = 0;
+	};
+
+	// Pin modes and values as left by a single parse pass
+	typedef struct Snapshot {
+		uint32_t sequence;
+		std::vector<uint8_t> modes;
+		std::vector<uint32_t> values;
+	} Snapshot;
+
+}
+
+#endif // !__FIRMSTATE_H__
@@ -0,0 +1,73 @@
+#ifndef __FIRMVIEW_H__
+#define __FIRMVIEW_H__
+
+#include <firmatacpp_export.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace firmata {
+
+	// Non-owning view of a received sysex payload. Only valid until the handler
+	// it is passed to returns; copy it (toVector) to keep it.
+	class ByteView {
+	public:
+		ByteView() : m_data(NULL), m_size(0) {};
+		ByteView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {};
+		ByteView(const std::vector<uint8_t>& data) : m_data(data.data()), m_size(data.size()) {};
+
+		const uint8_t* data() const { return m_data; };
+		size_t size() const { return m_size; };
+		bool empty() const { return m_size == 0; };
+
+		const uint8_t* begin() const { return m_data; };
+		const uint8_t* end() const { return m_data + m_size; };
+		uint8_t operator[](size_t index) const { return m_data[index]; };
+
+		ByteView subview(size_t offset) const
+		{
+			return offset < m_size ? ByteView(m_data + offset, m_size - offset) : ByteView();
+		}
+
+		std::vector<uint8_t> toVector() const { return std::vector<uint8_t>(begin(), end()); };
+
+		// Migration shim: lets extensions still declaring
+		// handleSysex(uint8_t, std::vector<uint8_t>) be dispatched, at the cost of a copy
+		FIRMATACPP_DEPRECATED operator std::vector<uint8_t>() const { return toVector(); };
+
+	private:
+		const uint8_t* m_data;
+		size_t m_size;
+	};
+
+	// Non-owning view of a received FIRMATA_STRING. Same lifetime rules as ByteView.
+	class StringView {
+	public:
+		StringView() : m_data(NULL), m_size(0) {};
+		StringView(const char* data, size_t size) : m_data(data), m_size(size) {};
+		StringView(const std::string& data) : m_data(data.data()), m_size(data.size()) {};
+
+		const char* data() const { return m_data; };
+		size_t size() const { return m_size; };
+		bool empty() const { return m_size == 0; };
+
+		const char* begin() const { return m_data; };
+		const char* end() const { return m_data + m_size; };
+		char operator[](size_t index) const { return m_data[index]; };
+
+		std::string toString() const { return std::string(m_data, m_size); };
+
+		// Migration shim: lets extensions still declaring handleString(std::string)
+		// be dispatched, at the cost of a copy
+		FIRMATACPP_DEPRECATED operator std::string() const { return toString(); };
+
+	private:
+		const char* m_data;
+		size_t m_size;
+	};
+
+}
+
+#endif // !__FIRMVIEW_H__
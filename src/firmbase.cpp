@@ -1,16 +1,65 @@
 #include "firmbase.h"
+#include "firmpack.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <iostream>
+#include <thread>
 
 namespace firmata {
 
 	Base::Base(FirmIO *firmIO)
-		: m_firmIO(firmIO), name(""), major_version(0), minor_version(0), is_ready(false)
+		: Base(firmIO, NULL)
 	{
+	}
+
+	Base::Base(FirmIO *firmIO, const FirmwareIdentity& identity)
+		: Base(firmIO, &identity)
+	{
+	}
+
+	Base::Base(FirmIO *firmIO, const FirmwareIdentity* identity)
+		: is_ready(false), name(""), major_version(0), minor_version(0), parse_timestamp(0),
+		m_publisher(NULL), m_publish_full(false), flight_pending(0), m_realtime(false), m_firmIO(firmIO),
+		sampling_interval(0), budget_baudrate(57600), budget_headroom(0.8), budget_action(BUDGET_OFF),
+		link_bytes(0), link_malformed(0), link_partial(0),
+		bulk_rate(0), bulk_burst(64), bulk_max_queued(4096), bulk_tokens(0), bulk_refilled(0),
+		m_auto_reconnect(false), m_connected(true), m_reconnecting(false),
+		m_retry_ms(500), m_next_attempt(0), m_down_since(0), m_disconnects(0), pin_table(NULL)
+	{
+		for (size_t pin = 0; pin < 256; pin++) {
+			configured_modes[pin].store(255, std::memory_order_relaxed);
+			written_values[pin].store(0, std::memory_order_relaxed);
+			written_pins[pin].store(false, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < 16; i++) {
+			analog_reports[i].store(false, std::memory_order_relaxed);
+			digital_reports[i].store(false, std::memory_order_relaxed);
+		}
+		memset(&m_connection_stats, 0, sizeof(m_connection_stats));
+		memset(pin_priorities, PRIORITY_BULK, sizeof(pin_priorities));
+		memset(&outbound_stats, 0, sizeof(outbound_stats));
+		resizePins(FIRMATA_DEFAULT_PINS);
+		parse_buffer.reserve(2 * FIRMATA_MSG_LEN);
+		string_buffer.reserve(FIRMATA_MSG_LEN / 2);
 		m_firmIO->open();
-		standardCommand({ FIRMATA_REPORT_VERSION });
+
+		if (identity) {
+			name = identity->name;
+			major_version = identity->major_version;
+			minor_version = identity->minor_version;
+			is_ready = true;
+			initPins();
+			capabilityQuery();
+			analogMappingQuery();
+			pinStateQuery();
+			return;
+		}
+
+		sendMessage(reportVersionMessage());
 		is_ready = awaitResponse(FIRMATA_REPORT_VERSION);
 		if (is_ready) {
 			init();
@@ -28,6 +77,198 @@ namespace firmata {
 		return is_ready;
 	}
 
+	FirmwareIdentity Base::firmwareIdentity()
+	{
+		FirmwareIdentity identity;
+		identity.name = name;
+		identity.major_version = major_version;
+		identity.minor_version = minor_version;
+		return identity;
+	}
+
+	bool Base::reconnect(uint32_t timeout)
+	{
+		uint64_t start = monotonicMicros();
+		uint64_t down_since = 0;
+		if (m_down_since.compare_exchange_strong(down_since, start)) down_since = start;
+
+		FirmwareIdentity previous = firmwareIdentity();
+		bool known_pins = pins.size() && analog_pins.size();
+		bool fast = false;
+
+		m_reconnecting = true;
+		try {
+			{
+				// Not while another thread is writing
+				std::lock_guard<std::mutex> lock(outbound_mutex);
+				m_firmIO->close();
+				m_firmIO->open();
+			}
+			m_connected = true;
+			parse_buffer.clear();
+
+			sendMessage(reportVersionMessage());
+			is_ready = m_connected && awaitResponse(FIRMATA_REPORT_VERSION, timeout);
+			if (is_ready) reportFirmware();
+
+			fast = known_pins && name == previous.name &&
+				major_version == previous.major_version && minor_version == previous.minor_version;
+			if (is_ready && !fast) {
+				initPins();
+				capabilityQuery();
+				analogMappingQuery();
+			}
+
+			if (is_ready && m_connected) {
+				// Its own batch, so a batch the caller has open is left alone
+				{
+					std::lock_guard<std::mutex> lock(outbound_mutex);
+					replay_batch.owner = std::this_thread::get_id();
+					replay_batch.depth = 1;
+				}
+				replayBaseConfiguration();
+				replayConfiguration();
+				endBatch();
+			}
+		}
+		catch (IOException&) {
+			is_ready = false;
+		}
+		catch (NotOpenException&) {
+			is_ready = false;
+		}
+		m_reconnecting = false;
+		{
+			std::lock_guard<std::mutex> lock(outbound_mutex);
+			replay_batch.depth = 0;
+			replay_batch.bytes.clear();
+			replay_batch.urgent = false;
+		}
+
+		uint64_t now = monotonicMicros();
+		std::lock_guard<std::mutex> lock(connection_mutex);
+		if (!is_ready || !m_connected) {
+			m_connected = false;
+			m_connection_stats.failed_attempts++;
+			m_next_attempt = now + (uint64_t)m_retry_ms * 1000;
+			return false;
+		}
+
+		m_connection_stats.reconnects++;
+		if (fast) m_connection_stats.fast_reconnects++;
+		m_connection_stats.last_reconnect_us = now - start;
+		m_connection_stats.last_downtime_us = now - down_since;
+		m_connection_stats.total_downtime_us += now - down_since;
+		m_down_since = 0;
+		return true;
+	}
+
+	void Base::setAutoReconnect(bool enable, uint32_t retry_ms)
+	{
+		m_auto_reconnect = enable;
+		m_retry_ms = retry_ms;
+	}
+
+	bool Base::connected()
+	{
+		return m_connected;
+	}
+
+	ConnectionStats Base::connectionStats()
+	{
+		ConnectionStats stats;
+		{
+			std::lock_guard<std::mutex> lock(connection_mutex);
+			stats = m_connection_stats;
+		}
+		stats.connected = m_connected;
+		stats.disconnects = m_disconnects.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	LinkStats Base::linkStats()
+	{
+		LinkStats stats;
+		stats.bytes_received = link_bytes.load(std::memory_order_relaxed);
+		stats.malformed_messages = link_malformed.load(std::memory_order_relaxed);
+		stats.partial_reads = link_partial.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	uint32_t Base::samplingInterval()
+	{
+		uint32_t interval = sampling_interval.load(std::memory_order_relaxed);
+		return interval ? interval : FIRMATA_DEFAULT_SAMPLING_INTERVAL;
+	}
+
+	void Base::beginBatch()
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		t_batch* batch = openBatch();
+		if (batch) {
+			batch->depth++;
+			return;
+		}
+
+		// Another thread's batch is open; this one's commands go out as sent
+		if (user_batch.depth) return;
+		user_batch.owner = std::this_thread::get_id();
+		user_batch.depth = 1;
+	}
+
+	void Base::endBatch()
+	{
+		std::unique_lock<std::mutex> lock(outbound_mutex);
+		t_batch* batch = openBatch();
+		if (!batch || --batch->depth > 0) return;
+		if (batch->bytes.empty()) return;
+
+		// Cleared before waiting for room, when another thread may start a batch
+		queue(batch->bytes.data(), batch->bytes.size(), batch->urgent ? PRIORITY_URGENT : PRIORITY_BULK);
+		batch->bytes.clear();
+		batch->urgent = false;
+		awaitQueueRoom(lock);
+	}
+
+	Base::t_batch* Base::openBatch()
+	{
+		std::thread::id self = std::this_thread::get_id();
+		if (replay_batch.depth && replay_batch.owner == self) return &replay_batch;
+		if (user_batch.depth && user_batch.owner == self) return &user_batch;
+		return NULL;
+	}
+
+	void Base::replayConfiguration()
+	{
+	}
+
+	void Base::replayBaseConfiguration()
+	{
+		uint32_t interval = sampling_interval.load(std::memory_order_relaxed);
+		if (interval) setSamplingInterval(interval);
+
+		for (size_t pin = 0; pin < pins.size() && pin < 256; pin++) {
+			uint8_t mode = configured_modes[pin].load(std::memory_order_relaxed);
+			if (mode == 255) continue;
+
+			pinMode((uint8_t)pin, mode);
+
+			// Outputs come back from a reset low, so restore what was last written. The
+			// pin table can't be used for this; a new firmware identity clears it.
+			if (!written_pins[pin].load(std::memory_order_acquire)) continue;
+			uint32_t value = written_values[pin].load(std::memory_order_relaxed);
+			if (mode == MODE_OUTPUT) digitalWrite((uint8_t)pin, (uint8_t)value);
+			else if (mode == MODE_PWM || mode == MODE_SERVO) analogWrite((uint8_t)pin, value);
+		}
+
+		for (uint8_t port = 0; port < 16; port++) {
+			if (digital_reports[port].load(std::memory_order_relaxed)) reportDigital(port, 1);
+		}
+		for (uint8_t channel = 0; channel < 16; channel++) {
+			if (analog_reports[channel].load(std::memory_order_relaxed)) reportAnalog(channel, 1);
+		}
+	}
+
 	void Base::init()
 	{
 		reportFirmware();
@@ -35,19 +276,29 @@ namespace firmata {
 		capabilityQuery();
 		analogMappingQuery();
 		pinStateQuery();
+
+		if (m_realtime) {
+			reserveBaseBuffers();
+			reserveBuffers();
+		}
 	}
 
 	void Base::pinMode(uint8_t pin, uint8_t mode)
 	{
-		pins[pin].mode = mode;
-		m_firmIO->write({ FIRMATA_SET_PIN_MODE, pin, mode });
+		t_pin_state* state = pinState(pin);
+		if (state) state->mode.store(mode, std::memory_order_relaxed);
+		configured_modes[pin].store(mode, std::memory_order_relaxed);
+		sendMessage(pinModeMessage(pin, mode), pinPriority(pin));
 	}
 
 	void Base::digitalWrite(uint8_t pin, uint8_t value = HIGH)
 	{
-		pins[pin].value = value;
+		t_pin_state* state = pinState(pin);
+		if (state) state->value.store(value, std::memory_order_relaxed);
+		written_values[pin].store(value, std::memory_order_relaxed);
+		written_pins[pin].store(true, std::memory_order_release);
 
-		standardCommand({ FIRMATA_SET_DIGITAL_PIN, pin, value });
+		sendMessage(digitalPinMessage(pin, value), pinPriority(pin));
 	}
 
 	void Base::analogWrite(uint8_t pin, uint32_t value)
@@ -56,245 +307,687 @@ namespace firmata {
 			return analogWriteExtended(pin, value);
 		}
 
-		pins[pin].value = value;
+		t_pin_state* state = pinState(pin);
+		if (state) state->value.store(value, std::memory_order_relaxed);
+		written_values[pin].store(value, std::memory_order_relaxed);
+		written_pins[pin].store(true, std::memory_order_release);
 
-		uint8_t analog_write_pin = FIRMATA_ANALOG_MESSAGE | pin;
-		uint8_t lsb = FIRMATA_LSB(value);
-		uint8_t msb = FIRMATA_MSB(value);
-		standardCommand({ analog_write_pin, lsb, msb });
+		sendMessage(analogMessage(pin, value), pinPriority(pin));
 	}
 
 	void Base::analogWriteExtended(uint8_t pin, uint32_t value)
 	{
-		pins[pin].value = value;
-
-		std::vector<uint8_t> bytes({ FIRMATA_EXTENDED_ANALOG, pin });
-		bytes.push_back(FIRMATA_LSB(value));
-		bytes.push_back(FIRMATA_MSB(value));
-
-		// Keep sending more significant bytes until value is complete
-		for (value >>= 14; value > 0; value >>= 7) {
-			bytes.push_back(FIRMATA_LSB(value));
-		}
-		sysexCommand(bytes);
+		t_pin_state* state = pinState(pin);
+		if (state) state->value.store(value, std::memory_order_relaxed);
+		written_values[pin].store(value, std::memory_order_relaxed);
+		written_pins[pin].store(true, std::memory_order_release);
+
+		uint8_t message[FIRMATA_EXTENDED_ANALOG_LEN];
+		size_t size = writeExtendedAnalog(message, pin, value);
+		sendMessage(message, size, pinPriority(pin));
 	}
 
 	void Base::analogWrite(const std::string& channel, uint32_t value)
 	{
-		if (channel[0] != 'A') return;
-		for (uint8_t pin = 0; pin < 127; pin++) {
-			if (pins[pin].analog_channel + '0' == channel[1]) {
-				pins[pin].value = value;
-				analogWrite(pin, value);
-				return;
-			}
-		}
+		analogWrite(analogChannel(channel), value);
+	}
+
+	void Base::analogWrite(AnalogChannel channel, uint32_t value)
+	{
+		if (channel.pin != FIRMATA_NO_PIN) analogWrite((uint8_t)channel.pin, value);
 	}
 
 	uint8_t Base::digitalRead(uint8_t pin)
 	{
-		return pins[pin].value;
+		t_pin_state* state = pinState(pin);
+		return state ? state->value.load(std::memory_order_relaxed) : 0;
 	}
 
 	uint32_t Base::analogRead(uint8_t pin)
 	{
-		return pins[pin].value;
+		t_pin_state* state = pinState(pin);
+		return state ? state->value.load(std::memory_order_relaxed) : 0;
 	}
 
 	uint32_t Base::analogRead(const std::string& channel)
 	{
-		if (channel[0] != 'A') return 0;
-		for (uint8_t pin = 0; pin < 127; pin++) {
-			if (pins[pin].analog_channel + '0' == channel[1]) {
-				return pins[pin].value;
+		return analogRead(analogChannel(channel));
+	}
+
+	uint32_t Base::analogRead(AnalogChannel channel)
+	{
+		return channel.pin != FIRMATA_NO_PIN ? analogRead((uint8_t)channel.pin) : 0;
+	}
+
+	void Base::setAnalogFilter(AnalogChannel channel, FilterChain* filter)
+	{
+		if (channel.pin == FIRMATA_NO_PIN) {
+			delete filter;
+			return;
+		}
+		if (!filter) {
+			pin_filters[channel.pin].reset();
+			return;
+		}
+
+		t_pin_filter* pin_filter = new t_pin_filter();
+		pin_filter->chain.reset(filter);
+		pin_filter->value.store(analogRead((uint8_t)channel.pin), std::memory_order_relaxed);
+		pin_filters[channel.pin].reset(pin_filter);
+	}
+
+	double Base::analogReadFiltered(uint8_t pin)
+	{
+		t_pin_filter* filter = pin_filters[pin].get();
+		return filter ? filter->value.load(std::memory_order_relaxed) : analogRead(pin);
+	}
+
+	double Base::analogReadFiltered(const std::string& channel)
+	{
+		return analogReadFiltered(analogChannel(channel));
+	}
+
+	double Base::analogReadFiltered(AnalogChannel channel)
+	{
+		return channel.pin != FIRMATA_NO_PIN ? analogReadFiltered((uint8_t)channel.pin) : 0;
+	}
+
+	AnalogChannel Base::analogChannel(const std::string& channel)
+	{
+		AnalogChannel none = { FIRMATA_NO_PIN };
+		if (channel.size() < 2 || channel.size() > 4 || channel[0] != 'A') return none;
+
+		uint32_t number = 0;
+		for (size_t i = 1; i < channel.size(); i++) {
+			if (channel[i] < '0' || channel[i] > '9') return none;
+			number = number * 10 + (channel[i] - '0');
+		}
+		if (number > 0xFF) return none;
+
+		return analogChannel((uint8_t)number);
+	}
+
+	AnalogChannel Base::analogChannel(uint8_t channel)
+	{
+		AnalogChannel resolved = { FIRMATA_NO_PIN };
+		if (channel < analog_pins.size()) resolved.pin = analog_pins[channel];
+		return resolved;
+	}
+
+	size_t Base::pinCount()
+	{
+		return pin_table.load(std::memory_order_acquire)->count;
+	}
+
+	const t_pin* Base::pinCapabilities(uint8_t pin)
+	{
+		return pin < pins.size() ? &pins[pin] : NULL;
+	}
+
+	t_pin_state* Base::pinState(uint8_t pin)
+	{
+		t_pin_table* table = pin_table.load(std::memory_order_acquire);
+		return pin < table->count ? &table->states[pin] : NULL;
+	}
+
+	void Base::resizePins(size_t count)
+	{
+		t_pin_table* current = pin_table.load(std::memory_order_relaxed);
+		if (current && current->count == count) return;
+
+		std::unique_ptr<t_pin_table> table(new t_pin_table());
+		table->count = count;
+		table->states.reset(new t_pin_state[count]);
+		for (size_t pin = 0; pin < count; pin++) {
+			bool kept = current && pin < current->count;
+			table->states[pin].mode.store(kept ? current->states[pin].mode.load(std::memory_order_relaxed) : 255, std::memory_order_relaxed);
+			table->states[pin].value.store(kept ? current->states[pin].value.load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+		}
+
+		pin_table.store(table.get(), std::memory_order_release);
+		pin_tables.push_back(std::move(table));
+
+		pins.resize(count);
+	}
+
+	void Base::snapshot(Snapshot& snapshot)
+	{
+		t_pin_table* table = pin_table.load(std::memory_order_acquire);
+		size_t count = table->count;
+		t_pin_state* states = table->states.get();
+
+		snapshot.modes.resize(count);
+		snapshot.values.resize(count);
+
+		uint32_t sequence;
+		do {
+			sequence = m_state_lock.readBegin();
+			for (size_t pin = 0; pin < count; pin++) {
+				snapshot.modes[pin] = states[pin].mode.load(std::memory_order_relaxed);
+				snapshot.values[pin] = states[pin].value.load(std::memory_order_relaxed);
 			}
+		} while (m_state_lock.readRetry(sequence));
+
+		snapshot.sequence = sequence >> 1;
+	}
+
+	bool Base::reportAnalog(uint8_t channel, uint8_t enable)
+	{
+		if (budget_action != BUDGET_OFF && enable && !analog_reports[channel & 0x0F].load(std::memory_order_relaxed)) {
+			ReportConfig proposed = reportConfig();
+			proposed.analog_channels.push_back(channel & 0x0F);
+			if (!admitReports(proposed)) return false;
 		}
-		return 0;
+
+		analog_reports[channel & 0x0F].store(enable != 0, std::memory_order_relaxed);
+		sendMessage(reportAnalogMessage(channel, enable));
+		return true;
 	}
 
-	void Base::reportAnalog(uint8_t channel, uint8_t enable)
+	bool Base::reportDigital(uint8_t port, uint8_t enable)
 	{
-		uint8_t report_channel = FIRMATA_REPORT_ANALOG | channel;
-		standardCommand({ report_channel, enable });
+		if (budget_action != BUDGET_OFF && enable && !digital_reports[port & 0x0F].load(std::memory_order_relaxed)) {
+			ReportConfig proposed = reportConfig();
+			proposed.digital_ports.push_back(port & 0x0F);
+			if (!admitReports(proposed)) return false;
+		}
+
+		digital_reports[port & 0x0F].store(enable != 0, std::memory_order_relaxed);
+		sendMessage(reportDigitalMessage(port, enable));
+		return true;
 	}
 
-	void Base::reportDigital(uint8_t port, uint8_t enable)
+	bool Base::setSamplingInterval(uint32_t intervalms)
 	{
-		uint8_t report_port = FIRMATA_REPORT_DIGITAL | port;
-		standardCommand({ report_port, enable });
+		if (budget_action != BUDGET_OFF && intervalms < samplingInterval()) {
+			ReportConfig proposed = reportConfig();
+			proposed.sampling_interval_ms = intervalms;
+			if (!admitReports(proposed)) return false;
+		}
+
+		sampling_interval.store(intervalms, std::memory_order_relaxed);
+		sendMessage(samplingIntervalMessage(intervalms));
+		return true;
 	}
 
-	void Base::setSamplingInterval(uint32_t intervalms)
+	void Base::setBandwidthBudget(uint32_t baudrate, double headroom, BudgetAction action)
 	{
+		budget_baudrate = baudrate;
+		budget_headroom = headroom;
+		budget_action = action;
+	}
 
-		uint8_t lsb = intervalms & 0x7F;
-		uint8_t msb = (intervalms >> 7) & 0x7F;
+	ReportConfig Base::reportConfig()
+	{
+		ReportConfig config;
+		config.baudrate = budget_baudrate;
+		config.sampling_interval_ms = samplingInterval();
+		for (uint8_t channel = 0; channel < 16; channel++) {
+			if (analog_reports[channel].load(std::memory_order_relaxed)) config.analog_channels.push_back(channel);
+		}
+		for (uint8_t port = 0; port < 16; port++) {
+			if (digital_reports[port].load(std::memory_order_relaxed)) config.digital_ports.push_back(port);
+		}
+		describeReports(config);
+		return config;
+	}
 
-		sysexCommand({ FIRMATA_SAMPLING_INTERVAL, lsb, msb });
+	void Base::describeReports(ReportConfig&)
+	{
 	}
 
-	void Base::standardCommand(std::vector<uint8_t> standard_command)
+	bool Base::budgetEnabled()
 	{
-		m_firmIO->write(standard_command);
+		return budget_action != BUDGET_OFF;
 	}
 
-	void Base::sysexCommand(uint8_t sysex_command)
+	bool Base::admitReports(const ReportConfig& proposed)
 	{
-		m_firmIO->write({ FIRMATA_START_SYSEX, sysex_command, FIRMATA_END_SYSEX });
+		if (budget_action == BUDGET_OFF) return true;
+
+		BandwidthEstimate estimate = estimateBandwidth(proposed);
+		if (withinBudget(estimate, budget_headroom)) return true;
+
+		std::cerr << "firmata: reports over " << (int)(100 * budget_headroom) << "% of the link, "
+			<< describeBandwidth(estimate) << (budget_action == BUDGET_REFUSE ? ", refused" : "") << std::endl;
+		return budget_action != BUDGET_REFUSE;
 	}
 
-	void Base::sysexCommand(std::vector<uint8_t> sysex_command)
+	void Base::sendMessage(const uint8_t* message, size_t size, Priority priority)
 	{
-		sysex_command.insert(sysex_command.begin(), FIRMATA_START_SYSEX);
-		sysex_command.insert(sysex_command.end(), FIRMATA_END_SYSEX);
+		send(message, size, priority);
+	}
 
-		m_firmIO->write(sysex_command);
+	void Base::standardCommand(std::vector<uint8_t> standard_command, Priority priority)
+	{
+		send(standard_command.data(), standard_command.size(), priority);
+	}
+
+	void Base::sysexCommand(uint8_t sysex_command, Priority priority)
+	{
+		sendMessage(sysexMessage(sysex_command), priority);
+	}
+
+	void Base::sysexCommand(std::vector<uint8_t> sysex_command, Priority priority)
+	{
+		// Frame it in a reused buffer rather than inserting at the front
+		std::unique_lock<std::mutex> lock(outbound_mutex);
+		sysex_buffer.resize(sysex_command.size() + 2);
+		sysex_buffer[0] = FIRMATA_START_SYSEX;
+		std::copy(sysex_command.begin(), sysex_command.end(), sysex_buffer.begin() + 1);
+		sysex_buffer[sysex_command.size() + 1] = FIRMATA_END_SYSEX;
+
+		sendLocked(sysex_buffer.data(), sysex_buffer.size(), priority, lock);
+	}
+
+	void Base::setPinPriority(uint8_t pin, Priority priority)
+	{
+		pin_priorities[pin] = priority;
+	}
+
+	Priority Base::pinPriority(uint8_t pin)
+	{
+		return (Priority)pin_priorities[pin];
+	}
+
+	void Base::setBulkBandwidth(uint32_t bytes_per_second, uint32_t burst_bytes, uint32_t max_queued_bytes)
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		bulk_rate = bytes_per_second;
+		bulk_burst = burst_bytes ? burst_bytes : 1;
+		bulk_max_queued = max_queued_bytes;
+		bulk_tokens = bulk_burst;
+		bulk_refilled = monotonicMicros();
+		pumpBulk();
+	}
+
+	void Base::pumpOutbound()
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		pumpBulk();
+	}
+
+	void Base::pumpBulk()
+	{
+		if (bulk_queue.empty()) return;
+
+		uint64_t now = monotonicMicros();
+		if (bulk_rate) {
+			bulk_tokens += (now - bulk_refilled) * (double)bulk_rate / 1000000;
+			if (bulk_tokens > bulk_burst) bulk_tokens = bulk_burst;
+		}
+		bulk_refilled = now;
+
+		while (!bulk_queue.empty()) {
+			t_outbound& message = bulk_queue.front();
+			size_t size = message.bytes.size();
+
+			// A message bigger than the burst goes out once the bucket is full
+			if (bulk_rate && bulk_tokens < size && bulk_tokens < bulk_burst) break;
+			if (bulk_rate) bulk_tokens -= size;
+
+			write(message.bytes.data(), size, message.queued, outbound_stats.bulk);
+			outbound_stats.bulk.queued_bytes -= size;
+			bulk_queue.pop_front();
+		}
+	}
+
+	void Base::flushOutbound()
+	{
+		std::unique_lock<std::mutex> lock(outbound_mutex);
+		while (!bulk_queue.empty()) {
+			uint64_t wait = bulkWait();
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds(wait));
+			lock.lock();
+			pumpBulk();
+		}
+	}
+
+	OutboundStats Base::outboundStats()
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		return outbound_stats;
+	}
+
+	uint64_t Base::bulkWait()
+	{
+		if (bulk_queue.empty() || !bulk_rate) return 0;
+
+		double needed = (double)bulk_queue.front().bytes.size();
+		if (needed > bulk_burst) needed = bulk_burst;
+		if (bulk_tokens >= needed) return 0;
+		return (uint64_t)((needed - bulk_tokens) * 1000000 / bulk_rate) + 1;
+	}
+
+	void Base::send(const uint8_t* bytes, size_t size, Priority priority)
+	{
+		// Also keeps messages from different threads from interleaving on the link
+		std::unique_lock<std::mutex> lock(outbound_mutex);
+		sendLocked(bytes, size, priority, lock);
+	}
+
+	void Base::sendLocked(const uint8_t* bytes, size_t size, Priority priority, std::unique_lock<std::mutex>& lock)
+	{
+		t_batch* batch = openBatch();
+		if (batch) {
+			batch->bytes.insert(batch->bytes.end(), bytes, bytes + size);
+			batch->urgent |= priority == PRIORITY_URGENT;
+			return;
+		}
+
+		queue(bytes, size, priority);
+		awaitQueueRoom(lock);
+	}
+
+	void Base::queue(const uint8_t* bytes, size_t size, Priority priority)
+	{
+		uint64_t now = monotonicMicros();
+		if (priority == PRIORITY_URGENT) {
+			write(bytes, size, now, outbound_stats.urgent);
+			return;
+		}
+		if (!bulk_rate && bulk_queue.empty()) {
+			write(bytes, size, now, outbound_stats.bulk);
+			return;
+		}
+
+		t_outbound message;
+		message.bytes.assign(bytes, bytes + size);
+		message.queued = now;
+		bulk_queue.push_back(message);
+		outbound_stats.bulk.queued_bytes += size;
+		pumpBulk();
+	}
+
+	void Base::awaitQueueRoom(std::unique_lock<std::mutex>& lock)
+	{
+		// Push back on the sender rather than queue without bound
+		while (outbound_stats.bulk.queued_bytes > bulk_max_queued) {
+			uint64_t wait = bulkWait();
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds(wait));
+			lock.lock();
+			pumpBulk();
+		}
+	}
+
+	void Base::write(const uint8_t* bytes, size_t size, uint64_t queued, OutboundClassStats& stats)
+	{
+		if (!m_connected) {
+			if (m_auto_reconnect) return;
+			throw NotOpenException();
+		}
+
+		try {
+			m_firmIO->write(bytes, size);
+		}
+		catch (IOException&) {
+			flightFailure("IOException on write");
+			if (!m_auto_reconnect && !m_reconnecting) throw;
+			connectionLost();
+			return;
+		}
+		catch (NotOpenException&) {
+			flightFailure("NotOpenException on write");
+			if (!m_auto_reconnect && !m_reconnecting) throw;
+			connectionLost();
+			return;
+		}
+
+		uint64_t now = monotonicMicros();
+		m_flight.record(FLIGHT_TX, now, bytes, size);
+
+		uint64_t latency = now - queued;
+		stats.messages++;
+		stats.bytes += size;
+		stats.total_latency_us += latency;
+		if (latency > stats.max_latency_us) stats.max_latency_us = latency;
+	}
+
+	bool Base::ensureConnected()
+	{
+		if (m_connected) return true;
+		if (!m_auto_reconnect || m_reconnecting) return false;
+		if (monotonicMicros() < m_next_attempt) return false;
+
+		return reconnect();
+	}
+
+	void Base::connectionLost()
+	{
+		m_connected = false;
+		is_ready = false;
+
+		// The parse thread and a sending thread can both see the same outage
+		uint64_t down_since = 0;
+		if (m_down_since.compare_exchange_strong(down_since, monotonicMicros())) {
+			m_disconnects.fetch_add(1, std::memory_order_relaxed);
+		}
+		m_next_attempt = m_reconnecting ? monotonicMicros() + (uint64_t)m_retry_ms * 1000 : 0;
 	}
 
 	uint16_t Base::parse(uint32_t num_commands)
 	{
-		std::vector<uint8_t> new_data = m_firmIO->read(FIRMATA_MSG_LEN);
-		std::vector<uint8_t> parse_buffer(saved_buffer);
-		parse_buffer.insert(parse_buffer.end(), new_data.begin(), new_data.end());
+		// Read straight onto the end of whatever was left over from the last call
+		if (!ensureConnected()) return 0;
+		if (!m_realtime) pumpOutbound();
+
+		size_t saved = parse_buffer.size();
+		size_t count = 0;
+		parse_buffer.resize(saved + FIRMATA_MSG_LEN);
+		try {
+			// Transports that wait for the whole request would sit out their timeout
+			// for a full buffer; in real-time mode only ask for what's there
+			size_t wanted = FIRMATA_MSG_LEN;
+			if (m_realtime) {
+				wanted = std::min(m_firmIO->available(), (size_t)FIRMATA_MSG_LEN);
+				if (!wanted) wanted = 1;
+			}
+			count = m_firmIO->read(parse_buffer.data() + saved, wanted);
+		}
+		catch (IOException&) {
+			parse_buffer.resize(saved);
+			flightFailure("IOException on read");
+			if (!m_auto_reconnect && !m_reconnecting) throw;
+			connectionLost();
+			return 0;
+		}
+		catch (NotOpenException&) {
+			parse_buffer.resize(saved);
+			flightFailure("NotOpenException on read");
+			if (!m_auto_reconnect && !m_reconnecting) throw;
+			connectionLost();
+			return 0;
+		}
+		parse_buffer.resize(saved + count);
+		link_bytes.fetch_add(count, std::memory_order_relaxed);
 		if (parse_buffer.size() == 0) return 0;
+		parse_timestamp = monotonicMicros();
+		if (count) m_flight.record(FLIGHT_RX, parse_timestamp, parse_buffer.data() + saved, count);
 
+		uint16_t last_completed = parseBuffer(num_commands);
+		flushFlightMessages();
+		if (m_publisher) publishPass();
+		return last_completed;
+	}
+
+	uint16_t Base::parseBuffer(uint32_t num_commands)
+	{
+		// Readers see either none or all of the values updated by this pass
+		SeqLockWriter state_writer(m_state_lock);
+
+		const uint8_t* buffer = parse_buffer.data();
+		const uint8_t* buffer_end = buffer + parse_buffer.size();
 		bool interrupted_command = false;
 		uint32_t completed_commands = 0;
+		uint16_t last_completed = 0;
 
-		for (int i = 0; i < parse_buffer.size(); i++) {
-			uint8_t whole_command, command_index, first_nibble;
-			uint16_t last_completed = 0;
+		for (size_t i = 0; i < parse_buffer.size(); i++) {
+			uint8_t whole_command, first_nibble;
+			size_t command_index, wanted, body;
 
 			command_index = i;
 
 			whole_command = parse_buffer[i];
 			first_nibble = FIRMATA_FIRST_NIBBLE(whole_command);
 
-			uint32_t value, channel, port;
+			// Every message starts with a status byte (high bit set), and only status bytes do.
+			// Noise, and the rest of anything we can't read, is skipped up to the next one.
+			if (first_nibble == FIRMATA_ANALOG_MESSAGE || first_nibble == FIRMATA_DIGITAL_MESSAGE || whole_command == FIRMATA_REPORT_VERSION) {
+				wanted = 2;
+			}
+			else if (whole_command == FIRMATA_START_SYSEX) {
+				wanted = 1;
+			}
+			else {
+				link_malformed.fetch_add(1, std::memory_order_relaxed);
+				size_t next = findStatusByte(buffer + i + 1, buffer_end) - buffer;
+				flightMessage(0, whole_command, next - i, 0);
+				i = next - 1;
+				continue;
+			}
 
-			switch (first_nibble) {
-			case(FIRMATA_ANALOG_MESSAGE) :
-				if (parse_buffer.size() < i + 3) {
-					interrupted_command = true;
+			// A status byte among the data bytes means this message was cut short; the
+			// next one starts there
+			for (body = 0; body < wanted && i + 1 + body < parse_buffer.size(); body++) {
+				if (buffer[i + 1 + body] & 0x80) break;
+			}
+			if (body < wanted && i + 1 + body < parse_buffer.size()) {
+				link_malformed.fetch_add(1, std::memory_order_relaxed);
+				flightMessage(0, whole_command, body + 1, 0);
+				i += body;
+				continue;
+			}
+			if (body < wanted) {
+				interrupted_command = true;
+			}
+			else if (whole_command == FIRMATA_START_SYSEX) {
+				uint8_t subcommand = parse_buffer[i + 1];
+
+				// Hand the sysex over in place and skip to next command. Any other status byte
+				// ends it early; a stray START_SYSEX doesn't swallow what follows.
+				const uint8_t* sysex_begin = buffer + i + 2;
+				const uint8_t* sysex_end = findStatusByte(sysex_begin, buffer_end);
+				if (sysex_end == buffer_end) {
+					if (sysex_end - (buffer + i) <= FIRMATA_MAX_SYSEX) {
+						interrupted_command = true;
+					}
+					else {
+						// Too long to be real. Drop it; the rest gets skipped as noise.
+						link_malformed.fetch_add(1, std::memory_order_relaxed);
+						flightMessage(0, whole_command, parse_buffer.size() - i, 0);
+						parse_buffer.clear();
+						return last_completed;
+					}
+				}
+				else if (*sysex_end != FIRMATA_END_SYSEX) {
+					link_malformed.fetch_add(1, std::memory_order_relaxed);
+					flightMessage(0, whole_command, sysex_end - (buffer + i), 0);
+					i = sysex_end - buffer - 1;
+					continue;
 				}
 				else {
-					channel = FIRMATA_LAST_NIBBLE(whole_command);
-					uint8_t lsb = parse_buffer[i + 1];
-					uint8_t msb = parse_buffer[i + 2];
-
-					if (lsb > 0x7F) continue; // TODO: Why do we sometimes get 2 analog message bytes instead of one. Off by one in savePartialBuffer?
-					if (msb > 0x7F) continue; // Why do we sometimes get only 1 data byte?
+					i = sysex_end - buffer;
+					flightMessage(whole_command, subcommand, sysex_end - sysex_begin, 0);
+					handleSysex(subcommand, ByteView(sysex_begin, sysex_end - sysex_begin));
+					completed_commands++;
+					last_completed = (whole_command << 8) | subcommand;
+				}
+			}
+			else {
+				uint8_t lsb = parse_buffer[i + 1];
+				uint8_t msb = parse_buffer[i + 2];
+				uint32_t value = FIRMATA_COMBINE_LSB_MSB(lsb, msb);
+				uint32_t channel, port;
 
-					value = FIRMATA_COMBINE_LSB_MSB(lsb, msb);
-					for (int pin = 0; pin < 128; pin++) {
-						if (pins[pin].analog_channel == channel) {
-							pins[pin].value = value;
-							break;
+				if (first_nibble == FIRMATA_ANALOG_MESSAGE) {
+					channel = FIRMATA_LAST_NIBBLE(whole_command);
+					if (channel < analog_pins.size() && analog_pins[channel] != FIRMATA_NO_PIN) {
+						uint8_t pin = (uint8_t)analog_pins[channel];
+						t_pin_state* state = pinState(pin);
+						if (state) {
+							state->value.store(value, std::memory_order_relaxed);
+							filterSample(pin, value);
+							notifySample(pin, value);
 						}
 					}
-					i += 2;
-					completed_commands++;
-					last_completed = whole_command;
 				}
-				break;
-			case(FIRMATA_DIGITAL_MESSAGE) :
-				if (parse_buffer.size() < i + 3) {
-					interrupted_command = true;
-				}
-				else {
+				else if (first_nibble == FIRMATA_DIGITAL_MESSAGE) {
 					port = FIRMATA_LAST_NIBBLE(whole_command);
-					uint8_t lsb = parse_buffer[i + 1];
-					uint8_t msb = parse_buffer[i + 2];
-
-					if (lsb > 0x7F) continue; // TODO: Why do we sometimes get 2 analog message bytes instead of one. Off by one in savePartialBuffer?
-					if (msb > 0x7F) continue; // Why do we sometimes get only 1 data byte?
-
-					value = FIRMATA_COMBINE_LSB_MSB(lsb, msb);
 					for (int pin = 0; pin < 8; pin++) {
-						if (pins[port * 8 + pin].mode == MODE_INPUT) {
-							pins[port * 8 + pin].value = FIRMATA_NTH_BIT(value, pin);
+						t_pin_state* state = pinState(port * 8 + pin);
+						if (state && state->mode.load(std::memory_order_relaxed) == MODE_INPUT) {
+							state->value.store(FIRMATA_NTH_BIT(value, pin), std::memory_order_relaxed);
+							notifySample(port * 8 + pin, FIRMATA_NTH_BIT(value, pin));
 						}
 					}
-					i += 2;
-					completed_commands++;
-					last_completed = whole_command;
-				}
-				break;
-			}
-
-			switch (whole_command) {
-			case(FIRMATA_REPORT_VERSION) :
-				if (parse_buffer.size() < i + 3) {
-					interrupted_command = true;
 				}
 				else {
-					major_version = parse_buffer[i + 1];
-					minor_version = parse_buffer[i + 2];
-					i += 2;
-					completed_commands++;
-					last_completed = whole_command;
+					major_version = lsb;
+					minor_version = msb;
 				}
-				break;
-			case(FIRMATA_START_SYSEX) :
-				if (parse_buffer.size() < i + 2) {
-					interrupted_command = true;
-				}
-				else {
-					uint8_t subcommand = parse_buffer[i + 1];
-
-					std::vector<uint8_t> sysex_buffer;
-					for (i = i + 2; i < parse_buffer.size() && parse_buffer[i] != FIRMATA_END_SYSEX; i++) { // Copy sysex and skip to next command
-						sysex_buffer.push_back(parse_buffer[i]);
-					}
-					if (i == parse_buffer.size()) {
-						interrupted_command = true;
-					}
-					else {
-						handleSysex(subcommand, sysex_buffer);
-						completed_commands++;
-						last_completed = (whole_command << 8) | subcommand;
-					}
-				}
-				break;
+				flightMessage(whole_command, 0, 0, value);
+				i += 2;
+				completed_commands++;
+				last_completed = whole_command;
 			}
 
 			if (interrupted_command) {
-				savePartialBuffer(parse_buffer.begin() + command_index, parse_buffer.end());
+				link_partial.fetch_add(1, std::memory_order_relaxed);
+				savePartialBuffer(command_index);
 				return last_completed;
 			}
 			else if (num_commands && num_commands == completed_commands) {
-				savePartialBuffer(parse_buffer.begin() + i + 1, parse_buffer.end());
+				savePartialBuffer(i + 1);
 				return last_completed;
 			}
 		}
+
+		parse_buffer.clear();
+		return last_completed;
 	}
 
-	bool Base::handleSysex(uint8_t subcommand, std::vector<uint8_t> data)
+	bool Base::handleSysex(uint8_t subcommand, ByteView data)
 	{
 		bool is_mode_byte;
-		uint8_t pin;
+		size_t pin, count;
+		uint32_t value;
+		t_pin_state* state;
 
 		switch (subcommand) {
 		case(FIRMATA_REPORT_FIRMWARE) :
+			if (data.size() < 2) {
+				link_malformed.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
 			major_version = data[0];
 			minor_version = data[1];
 
-			name = stringFromBytes(data.begin() + 2, data.end());
+			name = stringFromBytes(data.subview(2)).toString();
+			m_publish_full = true;
 
 
 			return true;
 
 		case(FIRMATA_CAPABILITY_RESPONSE) :
-			pin = 0;
 			is_mode_byte = true;
 
-			for (pin = 0; pin < 128; pin++) {
-				pins[pin].supported_modes = {};
-				pins[pin].resolutions = {};
+			// One 127 terminates each pin's list of modes
+			count = 0;
+			for (uint8_t byte : data) {
+				if (byte == 127) count++;
+			}
+			resizePins(count);
+
+			for (pin = 0; pin < count; pin++) {
+				pins[pin].supported_modes.clear();
+				pins[pin].resolutions.clear();
 			}
 
 			pin = 0;
 			for (uint8_t byte : data) {
+				if (pin >= count) break;
 				if (byte == 127) {
 					pin++;
 					is_mode_byte = true;
@@ -312,21 +1005,34 @@ namespace firmata {
 			return true;
 
 		case(FIRMATA_PIN_STATE_RESPONSE) :
-			pin = data[0];
-			pins[pin].mode = data[1];
-			pins[pin].value = data[2];
-			if (data.size() > 3) pins[pin].value |= (data[3] << 7);
-			if (data.size() > 4) pins[pin].value |= (data[4] << 14);
+			if (data.size() < 3) {
+				link_malformed.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+			state = pinState(data[0]);
+			if (!state) return true;
+
+			value = data[2];
+			if (data.size() > 3) value |= (data[3] << 7);
+			if (data.size() > 4) value |= (data[4] << 14);
+			state->mode.store(data[1], std::memory_order_relaxed);
+			state->value.store(value, std::memory_order_relaxed);
 			return true;
 
 		case(FIRMATA_ANALOG_MAPPING_RESPONSE) :
-			for (pin = 0; pin < data.size(); pin++) {
-				pins[pin].analog_channel = data[pin];
+			analog_pins.clear();
+			for (pin = 0; pin < data.size() && pin < pins.size(); pin++) {
+				uint8_t channel = data[pin];
+				pins[pin].analog_channel = channel;
+				if (channel == FIRMATA_NO_ANALOG_CHANNEL || pin > 0xFF) continue;
+
+				if (channel >= analog_pins.size()) analog_pins.resize(channel + 1, FIRMATA_NO_PIN);
+				analog_pins[channel] = pin;
 			}
 			return true;
 
 		case(FIRMATA_STRING) :
-			handleString(stringFromBytes(data.begin(), data.end()));
+			handleString(stringFromBytes(data));
 			return true;
 
 		}
@@ -334,26 +1040,153 @@ namespace firmata {
 		return false;
 	}
 
-	bool Base::handleString(std::string data)
+	bool Base::handleString(StringView data)
 	{
-		std::cout << data << std::endl;
+		if (!m_realtime) std::cout.write(data.data(), data.size()) << std::endl;
 		return false;
 	}
 
-	void Base::savePartialBuffer(std::vector<uint8_t>::iterator begin, std::vector<uint8_t>::iterator end) {
-		saved_buffer = {};
-		for (auto byte = begin; byte != end; ++byte) {
-			saved_buffer.push_back(*byte);
+	void Base::addSampleListener(SampleListener* listener)
+	{
+		sample_listeners.push_back(listener);
+	}
+
+	void Base::removeSampleListener(SampleListener* listener)
+	{
+		for (auto it = sample_listeners.begin(); it != sample_listeners.end(); ++it) {
+			if (*it == listener) {
+				sample_listeners.erase(it);
+				return;
+			}
+		}
+	}
+
+	FlightRecorder& Base::flightRecorder()
+	{
+		return m_flight;
+	}
+
+	RealtimeStatus Base::enterRealtime(const RealtimeConfig& config)
+	{
+		// Reserve before memory is locked, so the buffers are locked too
+		m_realtime = true;
+		reserveBaseBuffers();
+		reserveBuffers();
+
+		RealtimeStatus status = applyRealtime(config);
+		status.preallocated = true;
+		return status;
+	}
+
+	bool Base::realtime()
+	{
+		return m_realtime;
+	}
+
+	void Base::reserveBuffers()
+	{
+	}
+
+	void Base::reserveBaseBuffers()
+	{
+		// A full read on top of the longest message kept across reads
+		parse_buffer.reserve(FIRMATA_MSG_LEN + FIRMATA_MAX_SYSEX);
+		string_buffer.reserve(FIRMATA_MAX_SYSEX / 2);
+		sysex_buffer.reserve(FIRMATA_MAX_SYSEX + 2);
+
+		// Replaying the configuration batches a mode and a value for every pin
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		replay_batch.bytes.reserve(pins.size() * (3 + FIRMATA_EXTENDED_ANALOG_LEN) + FIRMATA_MSG_LEN);
+		user_batch.bytes.reserve(FIRMATA_MSG_LEN);
+	}
+
+	void Base::flightFailure(const std::string& what)
+	{
+		m_flight.recordEvent(what);
+
+		// Failed reconnect attempts are expected while the board is away
+		if (!m_reconnecting) m_flight.dump(what);
+	}
+
+	void Base::flightMessage(uint8_t command, uint8_t subcommand, size_t length, uint32_t value)
+	{
+		if (length > 0xFFFF) length = 0xFFFF;
+
+		// Little-endian, as FlightEntry::messages() reads it
+		uint8_t* header = flight_messages + flight_pending;
+		header[0] = command;
+		header[1] = subcommand;
+		header[2] = (uint8_t)length;
+		header[3] = (uint8_t)(length >> 8);
+		header[4] = (uint8_t)value;
+		header[5] = (uint8_t)(value >> 8);
+		header[6] = (uint8_t)(value >> 16);
+		header[7] = (uint8_t)(value >> 24);
+
+		flight_pending += 8;
+		if (flight_pending == sizeof(flight_messages)) flushFlightMessages();
+	}
+
+	void Base::flushFlightMessages()
+	{
+		if (!flight_pending) return;
+		m_flight.record(FLIGHT_MESSAGES, parse_timestamp, flight_messages, flight_pending);
+		flight_pending = 0;
+	}
+
+	void Base::publish(ShmPublisher* publisher)
+	{
+		m_publisher = publisher && publisher->isOpen() ? publisher : NULL;
+		m_publish_full = true;
+	}
+
+	void Base::publishState(ShmPublisher&, bool)
+	{
+	}
+
+	void Base::publishPass()
+	{
+		m_publisher->begin();
+		if (m_publish_full) m_publisher->setIdentity(name, major_version, minor_version);
+
+		t_pin_table* table = pin_table.load(std::memory_order_relaxed);
+		m_publisher->setPins(table->count, table->states.get());
+
+		publishState(*m_publisher, m_publish_full);
+		m_publisher->end();
+		m_publish_full = false;
+	}
+
+	void Base::notifySample(uint8_t pin, uint32_t value)
+	{
+		for (SampleListener* listener : sample_listeners) {
+			listener->onSample(pin, value, parse_timestamp);
+		}
+	}
+
+	void Base::filterSample(uint8_t pin, uint32_t value)
+	{
+		t_pin_filter* filter = pin_filters[pin].get();
+		if (!filter) return;
+
+		double output;
+		if (filter->chain->update(value, output)) {
+			filter->value.store(output, std::memory_order_relaxed);
 		}
 	}
 
-	std::string Base::stringFromBytes(std::vector<uint8_t>::iterator begin, std::vector<uint8_t>::iterator end)
+	void Base::savePartialBuffer(size_t begin) {
+		// Keeps capacity, so steady-state parsing doesn't reallocate
+		parse_buffer.erase(parse_buffer.begin(), parse_buffer.begin() + begin);
+	}
+
+	StringView Base::stringFromBytes(ByteView bytes)
 	{
-		std::string s;
-		for (auto byte = begin; byte < end - 1; ++byte) {
-			s += (*byte) | (*(++byte) << 7);
+		string_buffer.resize(bytes.size() / 2);
+		if (string_buffer.size()) {
+			decode7BitPairs(bytes.data(), bytes.size(), (uint8_t*)&string_buffer[0]);
 		}
-		return s;
+		return StringView(string_buffer);
 	}
 
 	bool Base::awaitResponse(uint8_t command, uint32_t timeout)
@@ -371,6 +1204,9 @@ namespace firmata {
 			elapsed = current - start;
 			if (elapsed > timeoutDuration) {
 				succeeded = false;
+				char what[64];
+				snprintf(what, sizeof(what), "timeout waiting for 0x%02X", command);
+				flightFailure(what);
 				break;
 			}
 
@@ -394,6 +1230,9 @@ namespace firmata {
 			elapsed = current - start;
 			if (elapsed > timeoutDuration) {
 				succeeded = false;
+				char what[64];
+				snprintf(what, sizeof(what), "timeout waiting for sysex 0x%02X", sysexCommand);
+				flightFailure(what);
 				break;
 			}
 
@@ -407,13 +1246,17 @@ namespace firmata {
 
 	void Base::initPins()
 	{
-		for (int i = 0; i < 128; i++) {
-			pins[i].mode = 255;
-			pins[i].analog_channel = 127;
-			pins[i].supported_modes = {};
-			pins[i].resolutions = {};
-			pins[i].value = 0;
+		t_pin_table* table = pin_table.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < table->count; i++) {
+			table->states[i].mode.store(255, std::memory_order_relaxed);
+			table->states[i].value.store(0, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < pins.size(); i++) {
+			pins[i].analog_channel = FIRMATA_NO_ANALOG_CHANNEL;
+			pins[i].supported_modes.clear();
+			pins[i].resolutions.clear();
 		}
+		analog_pins.clear();
 	}
 
 	void Base::reportFirmware() {
@@ -429,19 +1272,19 @@ namespace firmata {
 	void Base::analogMappingQuery() {
 		sysexCommand(FIRMATA_ANALOG_MAPPING_QUERY);
 		awaitSysexResponse(FIRMATA_ANALOG_MAPPING_RESPONSE);
-		for (uint8_t pin = 0; pin < 128; pin++) {
-			if (pins[pin].analog_channel < 127) {
-				pins[pin].mode = MODE_ANALOG;
-				standardCommand({ FIRMATA_SET_PIN_MODE, pin, MODE_ANALOG });
+		for (size_t pin = 0; pin < pins.size() && pin < FIRMATA_MAX_PINS; pin++) {
+			if (pins[pin].analog_channel != FIRMATA_NO_ANALOG_CHANNEL) {
+				pinState(pin)->mode.store(MODE_ANALOG, std::memory_order_relaxed);
+				sendMessage(pinModeMessage((uint8_t)pin, MODE_ANALOG));
 			}
 		}
 	}
 
 	void Base::pinStateQuery() {
 		// send a state query for for every pin with any modes                                
-		for (uint8_t pin = 0; pin < 128; pin++) {
+		for (size_t pin = 0; pin < pins.size() && pin < FIRMATA_MAX_PINS; pin++) {
 			if (pins[pin].supported_modes.size()) {
-				sysexCommand({ FIRMATA_PIN_STATE_QUERY, pin });
+				sendMessage(pinStateQueryMessage((uint8_t)pin));
 //				awaitSysexResponse(FIRMATA_PIN_STATE_RESPONSE, 100);
 			}
 		}
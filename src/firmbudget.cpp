@@ -0,0 +1,57 @@
+#include "firmbudget.h"
+
+#include <cstdio>
+
+namespace firmata {
+
+	BandwidthEstimate estimateBandwidth(const ReportConfig& config)
+	{
+		BandwidthEstimate estimate;
+		double samples_per_second = config.sampling_interval_ms ? 1000.0 / config.sampling_interval_ms : 1000.0;
+
+		// A start and a stop bit around every byte
+		estimate.capacity = config.baudrate / 10.0;
+
+		// One 3 byte analog message per channel per sampling interval
+		estimate.analog_in = 3 * config.analog_channels.size() * samples_per_second;
+
+		// One 3 byte digital message per port per change
+		estimate.digital_in = 3 * config.digital_ports.size() * config.digital_changes_per_second;
+
+		// START_SYSEX, I2C_REPLY, address and register as 7-bit pairs, data as 7-bit pairs, END_SYSEX
+		estimate.i2c_in = 0;
+		for (const I2CReport& report : config.i2c_reports) {
+			estimate.i2c_in += (7 + 2.0 * report.bytes) * samples_per_second;
+		}
+
+		estimate.inbound = estimate.analog_in + estimate.digital_in + estimate.i2c_in;
+		estimate.outbound = 3 * config.outbound_messages_per_second;
+		estimate.inbound_utilization = estimate.capacity > 0 ? estimate.inbound / estimate.capacity : 0;
+		estimate.outbound_utilization = estimate.capacity > 0 ? estimate.outbound / estimate.capacity : 0;
+
+		// SAMPLING_INTERVAL sysex, a 2 byte report per channel and port, an I2C_REQUEST per read
+		estimate.setup_bytes = 5;
+		estimate.setup_bytes += 2 * (uint32_t)(config.analog_channels.size() + config.digital_ports.size());
+		for (const I2CReport& report : config.i2c_reports) {
+			estimate.setup_bytes += report.reg ? 9 : 7;
+		}
+
+		return estimate;
+	}
+
+	bool withinBudget(const BandwidthEstimate& estimate, double headroom)
+	{
+		return estimate.inbound_utilization <= headroom && estimate.outbound_utilization <= headroom;
+	}
+
+	std::string describeBandwidth(const BandwidthEstimate& estimate)
+	{
+		char description[256];
+		snprintf(description, sizeof(description),
+			"in %.0f B/s (%.0f%%: analog %.0f, digital %.0f, i2c %.0f), out %.0f B/s (%.0f%%) of %.0f B/s",
+			estimate.inbound, 100 * estimate.inbound_utilization, estimate.analog_in, estimate.digital_in,
+			estimate.i2c_in, estimate.outbound, 100 * estimate.outbound_utilization, estimate.capacity);
+		return description;
+	}
+
+}
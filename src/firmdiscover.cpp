@@ -0,0 +1,121 @@
+#include "firmdiscover.h"
+#include "firmpack.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace firmata {
+
+	// Look for a version report and a firmware report in what the port sent so far
+	static bool scanReplies(const std::vector<uint8_t>& bytes, DiscoveredBoard& board)
+	{
+		bool has_firmware = false;
+
+		for (size_t i = 0; i < bytes.size(); i++) {
+			if (bytes[i] == FIRMATA_REPORT_VERSION && i + 2 < bytes.size()) {
+				board.protocol_major_version = bytes[i + 1];
+				board.protocol_minor_version = bytes[i + 2];
+				i += 2;
+			}
+			else if (bytes[i] == FIRMATA_START_SYSEX && i + 1 < bytes.size() && bytes[i + 1] == FIRMATA_REPORT_FIRMWARE) {
+				const uint8_t* begin = bytes.data() + i + 2;
+				const uint8_t* end = findEndSysex(begin, bytes.data() + bytes.size());
+				if (end == bytes.data() + bytes.size()) break;
+				if (end - begin < 2) continue;
+
+				std::string name((end - begin - 2) / 2, '\0');
+				if (name.size()) decode7BitPairs(begin + 2, end - begin - 2, (uint8_t*)&name[0]);
+
+				board.identity.major_version = begin[0];
+				board.identity.minor_version = begin[1];
+				board.identity.name = name;
+				has_firmware = true;
+				i = end - bytes.data();
+			}
+		}
+
+		return has_firmware;
+	}
+
+	static bool probe(const PortInfo& port, const DiscoveryOptions& options,
+		std::chrono::steady_clock::time_point deadline, DiscoveredBoard& board)
+	{
+		std::unique_ptr<FirmSerial> serial;
+		std::vector<uint8_t> replies;
+		std::chrono::steady_clock::time_point next_probe = std::chrono::steady_clock::now();
+
+		try {
+			serial.reset(new FirmSerial(port.port, options.baudrate, 0));
+
+			while (std::chrono::steady_clock::now() < deadline) {
+				if (std::chrono::steady_clock::now() >= next_probe) {
+					serial->write({ FIRMATA_REPORT_VERSION, FIRMATA_START_SYSEX, FIRMATA_REPORT_FIRMWARE, FIRMATA_END_SYSEX });
+					next_probe += std::chrono::milliseconds(options.probe_interval_ms);
+				}
+
+				size_t available = serial->available();
+				if (!available) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					continue;
+				}
+
+				size_t saved = replies.size();
+				replies.resize(saved + available);
+				replies.resize(saved + serial->read(replies.data() + saved, available));
+
+				if (scanReplies(replies, board)) {
+					if (board.identity.name.find(options.firmware) == std::string::npos) return false;
+
+					board.port = port;
+					board.serial = serial.release();
+					return true;
+				}
+			}
+		}
+		catch (IOException&) {
+		}
+		catch (NotOpenException&) {
+		}
+
+		return false;
+	}
+
+	std::vector<DiscoveredBoard> discover(const DiscoveryOptions& options)
+	{
+		return discover(FirmSerial::listPorts(), options);
+	}
+
+	std::vector<DiscoveredBoard> discover(const std::vector<PortInfo>& ports, const DiscoveryOptions& options)
+	{
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(options.timeout_ms);
+
+		std::vector<DiscoveredBoard> candidates(ports.size());
+		std::unique_ptr<bool[]> found(new bool[ports.size()]);
+		std::vector<std::thread> probes;
+
+		for (size_t i = 0; i < ports.size(); i++) {
+			candidates[i].protocol_major_version = 0;
+			candidates[i].protocol_minor_version = 0;
+			candidates[i].identity.major_version = 0;
+			candidates[i].identity.minor_version = 0;
+			candidates[i].serial = NULL;
+			found[i] = false;
+
+			probes.push_back(std::thread([&, i]() {
+				found[i] = probe(ports[i], options, deadline, candidates[i]);
+			}));
+		}
+		for (std::thread& t : probes) {
+			t.join();
+		}
+
+		std::vector<DiscoveredBoard> boards;
+		for (size_t i = 0; i < ports.size(); i++) {
+			if (found[i]) boards.push_back(candidates[i]);
+		}
+		return boards;
+	}
+
+}
@@ -0,0 +1,188 @@
+#include "firmfilter.h"
+
+#include <algorithm>
+
+namespace firmata {
+
+	EmaFilter::EmaFilter(double alpha)
+		: m_alpha(alpha), m_value(0), m_primed(false)
+	{
+	}
+
+	bool EmaFilter::update(double input, double& output)
+	{
+		if (m_primed) {
+			m_value += m_alpha * (input - m_value);
+		}
+		else {
+			m_value = input;
+			m_primed = true;
+		}
+		output = m_value;
+		return true;
+	}
+
+	void EmaFilter::reset()
+	{
+		m_value = 0;
+		m_primed = false;
+	}
+
+	WindowFilter::WindowFilter(uint32_t size)
+		: m_window(size ? size : 1), m_size(size ? size : 1), m_count(0), m_next(0), m_total(0)
+	{
+	}
+
+	void WindowFilter::reset()
+	{
+		m_count = 0;
+		m_next = 0;
+		m_total = 0;
+	}
+
+	bool WindowFilter::push(double input, double& evicted)
+	{
+		bool full = m_count == m_size;
+		evicted = m_window[m_next];
+		m_window[m_next] = input;
+		m_next = (m_next + 1) % m_size;
+		if (!full) m_count++;
+		m_total++;
+		return full;
+	}
+
+	MeanFilter::MeanFilter(uint32_t size)
+		: WindowFilter(size), m_sum(0)
+	{
+	}
+
+	bool MeanFilter::update(double input, double& output)
+	{
+		double evicted;
+		if (push(input, evicted)) m_sum -= evicted;
+		m_sum += input;
+
+		// Recompute now and then so rounding in the running sum can't accumulate
+		if (m_total % (64 * (uint64_t)m_size) == 0) {
+			m_sum = 0;
+			for (uint32_t i = 0; i < m_count; i++) m_sum += m_window[i];
+		}
+
+		output = m_sum / m_count;
+		return true;
+	}
+
+	void MeanFilter::reset()
+	{
+		WindowFilter::reset();
+		m_sum = 0;
+	}
+
+	ExtremumFilter::ExtremumFilter(uint32_t size, bool maximum)
+		: WindowFilter(size), m_maximum(maximum), m_values(m_size), m_positions(m_size), m_head(0), m_length(0)
+	{
+	}
+
+	bool ExtremumFilter::update(double input, double& output)
+	{
+		double evicted;
+		push(input, evicted);
+		uint64_t position = m_total - 1;
+
+		// Drop candidates that have left the window
+		if (m_length && m_positions[m_head] + m_size <= position) {
+			m_head = (m_head + 1) % m_size;
+			m_length--;
+		}
+
+		// Drop candidates the new sample dominates
+		while (m_length) {
+			uint32_t tail = (m_head + m_length - 1) % m_size;
+			bool dominated = m_maximum ? m_values[tail] <= input : m_values[tail] >= input;
+			if (!dominated) break;
+			m_length--;
+		}
+
+		uint32_t slot = (m_head + m_length) % m_size;
+		m_values[slot] = input;
+		m_positions[slot] = position;
+		m_length++;
+
+		output = m_values[m_head];
+		return true;
+	}
+
+	void ExtremumFilter::reset()
+	{
+		WindowFilter::reset();
+		m_head = 0;
+		m_length = 0;
+	}
+
+	MedianFilter::MedianFilter(uint32_t size)
+		: WindowFilter(size)
+	{
+		m_sorted.reserve(m_size);
+	}
+
+	bool MedianFilter::update(double input, double& output)
+	{
+		double evicted;
+		if (push(input, evicted)) {
+			m_sorted.erase(std::lower_bound(m_sorted.begin(), m_sorted.end(), evicted));
+		}
+		m_sorted.insert(std::upper_bound(m_sorted.begin(), m_sorted.end(), input), input);
+
+		size_t middle = m_sorted.size() / 2;
+		output = m_sorted.size() % 2 ? m_sorted[middle] : (m_sorted[middle - 1] + m_sorted[middle]) / 2;
+		return true;
+	}
+
+	void MedianFilter::reset()
+	{
+		WindowFilter::reset();
+		m_sorted.clear();
+	}
+
+	DecimateFilter::DecimateFilter(uint32_t factor)
+		: m_factor(factor ? factor : 1), m_count(0)
+	{
+	}
+
+	bool DecimateFilter::update(double input, double& output)
+	{
+		if (++m_count < m_factor) return false;
+
+		m_count = 0;
+		output = input;
+		return true;
+	}
+
+	void DecimateFilter::reset()
+	{
+		m_count = 0;
+	}
+
+	FilterChain& FilterChain::add(Filter* filter)
+	{
+		m_filters.push_back(std::unique_ptr<Filter>(filter));
+		return *this;
+	}
+
+	bool FilterChain::update(double input, double& output)
+	{
+		for (auto& filter : m_filters) {
+			if (!filter->update(input, input)) return false;
+		}
+		output = input;
+		return true;
+	}
+
+	void FilterChain::reset()
+	{
+		for (auto& filter : m_filters) {
+			filter->reset();
+		}
+	}
+
+}
@@ -0,0 +1,300 @@
+#include "firmflight.h"
+#include "firmstate.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#define FIRMATA_FLIGHT_MAGIC		"FIRMFLT1"
+#define FIRMATA_FLIGHT_ENTRY_LEN	16
+
+namespace {
+
+	void putLE(std::vector<uint8_t>& out, uint64_t value, int bytes)
+	{
+		for (int i = 0; i < bytes; i++) {
+			out.push_back((uint8_t)(value >> (8 * i)));
+		}
+	}
+
+	uint64_t getLE(const uint8_t* in, int bytes)
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < bytes; i++) {
+			value |= (uint64_t)in[i] << (8 * i);
+		}
+		return value;
+	}
+
+	uint64_t wallMicros()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+}
+
+namespace firmata {
+
+	std::vector<FlightMessage> FlightEntry::messages() const
+	{
+		std::vector<FlightMessage> messages;
+		if (type != FLIGHT_MESSAGES) return messages;
+
+		for (size_t i = 0; i + 8 <= bytes.size(); i += 8) {
+			FlightMessage message;
+			message.command = bytes[i];
+			message.subcommand = bytes[i + 1];
+			message.length = (uint16_t)getLE(&bytes[i + 2], 2);
+			message.value = (uint32_t)getLE(&bytes[i + 4], 4);
+			messages.push_back(message);
+		}
+		return messages;
+	}
+
+	FlightRecorder::FlightRecorder(uint32_t slots)
+		: m_head(0), m_max_dumps(0), m_dumps(0)
+	{
+		// A power of two, so the slot is the index masked
+		uint64_t size = 1;
+		while (size < slots) size <<= 1;
+		m_mask = size - 1;
+
+		m_slots.reset(new t_flight_slot[size]);
+		for (uint64_t i = 0; i < size; i++) {
+			m_slots[i].sequence.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void FlightRecorder::record(FlightEntryType type, uint64_t timestamp, const uint8_t* bytes, size_t size)
+	{
+		uint8_t flags = 0;
+		if (size > FIRMATA_FLIGHT_MAX_CHUNK) {
+			size = FIRMATA_FLIGHT_MAX_CHUNK;
+			flags |= FIRMATA_FLIGHT_TRUNCATED;
+		}
+
+		// Claim every slot the chunk needs at once, so its pieces stay together
+		uint64_t pieces = size ? (size + FIRMATA_FLIGHT_SLOT_BYTES - 1) / FIRMATA_FLIGHT_SLOT_BYTES : 1;
+		uint64_t index = m_head.fetch_add(pieces, std::memory_order_relaxed);
+
+		for (uint64_t piece = 0; piece < pieces; piece++, index++) {
+			t_flight_slot& slot = m_slots[index & m_mask];
+			size_t offset = piece * FIRMATA_FLIGHT_SLOT_BYTES;
+			size_t piece_size = size - offset < FIRMATA_FLIGHT_SLOT_BYTES ? size - offset : FIRMATA_FLIGHT_SLOT_BYTES;
+
+			slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			slot.timestamp.store(timestamp, std::memory_order_relaxed);
+			slot.header.store((uint64_t)type | (uint64_t)flags << 8 | (uint64_t)piece_size << 16 |
+				(uint64_t)offset << 32 | (uint64_t)size << 48, std::memory_order_relaxed);
+
+			const uint8_t* piece_bytes = bytes + offset;
+			size_t i = 0;
+			for (; (i + 1) * 8 <= piece_size; i++) {
+				uint64_t word;
+				memcpy(&word, piece_bytes + i * 8, 8);
+				slot.data[i].store(word, std::memory_order_relaxed);
+			}
+			if (i * 8 < piece_size) {
+				uint64_t word = 0;
+				memcpy(&word, piece_bytes + i * 8, piece_size - i * 8);
+				slot.data[i].store(word, std::memory_order_relaxed);
+			}
+
+			slot.sequence.store(2 * index + 2, std::memory_order_release);
+		}
+	}
+
+	void FlightRecorder::recordEvent(const std::string& text)
+	{
+		record(FLIGHT_EVENT, monotonicMicros(), (const uint8_t*)text.data(), text.size());
+	}
+
+	uint64_t FlightRecorder::recorded()
+	{
+		return m_head.load(std::memory_order_relaxed);
+	}
+
+	void FlightRecorder::setDumpPrefix(const std::string& prefix, uint32_t max_dumps)
+	{
+		std::vector<std::string> pending;
+		{
+			std::lock_guard<std::mutex> lock(m_dump_mutex);
+			m_prefix = prefix;
+			m_max_dumps = max_dumps;
+			pending.swap(m_pending);
+		}
+
+		// One dump for all of them, named for the first failure; the ring holds the same bytes for each
+		if (!prefix.empty() && pending.size()) dump(pending.front());
+	}
+
+	std::string FlightRecorder::dump(const std::string& reason)
+	{
+		std::string path;
+		{
+			std::lock_guard<std::mutex> lock(m_dump_mutex);
+			if (m_prefix.empty()) {
+				if (m_pending.size() < 16) m_pending.push_back(reason);
+				return "";
+			}
+			if (m_dumps >= m_max_dumps) return "";
+
+			char name[64];
+			snprintf(name, sizeof(name), "-%llu-%u.flight", (unsigned long long)(wallMicros() / 1000), ++m_dumps);
+			path = m_prefix + name;
+		}
+
+		return dumpTo(path, reason) ? path : "";
+	}
+
+	bool FlightRecorder::dumpTo(const std::string& path, const std::string& reason)
+	{
+		std::vector<FlightEntry> recorded = entries();
+
+		std::vector<uint8_t> out(FIRMATA_FLIGHT_MAGIC, FIRMATA_FLIGHT_MAGIC + 8);
+		putLE(out, monotonicMicros(), 8);
+		putLE(out, wallMicros(), 8);
+		putLE(out, reason.size(), 4);
+		out.insert(out.end(), reason.begin(), reason.end());
+		putLE(out, recorded.size(), 4);
+
+		for (const FlightEntry& entry : recorded) {
+			putLE(out, entry.timestamp, 8);
+			putLE(out, entry.type, 1);
+			putLE(out, entry.flags, 1);
+			putLE(out, 0, 2);
+			putLE(out, entry.bytes.size(), 4);
+			out.insert(out.end(), entry.bytes.begin(), entry.bytes.end());
+		}
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file) return false;
+		bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+		return fclose(file) == 0 && written;
+	}
+
+	std::vector<FlightEntry> FlightRecorder::entries()
+	{
+		std::vector<FlightEntry> entries;
+		uint64_t head = m_head.load(std::memory_order_acquire);
+		uint64_t size = m_mask + 1;
+		uint64_t index = head > size ? head - size : 0;
+
+		FlightEntry entry;
+		bool building = false;
+		for (; index < head; index++) {
+			t_flight_slot& slot = m_slots[index & m_mask];
+
+			// Skip slots being written, or already reused by a writer that lapped us
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence != 2 * index + 2) {
+				building = false;
+				continue;
+			}
+			uint64_t timestamp = slot.timestamp.load(std::memory_order_relaxed);
+			uint64_t header = slot.header.load(std::memory_order_relaxed);
+			uint64_t words[FIRMATA_FLIGHT_SLOT_BYTES / 8];
+			for (size_t i = 0; i < FIRMATA_FLIGHT_SLOT_BYTES / 8; i++) {
+				words[i] = slot.data[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+				building = false;
+				continue;
+			}
+
+			size_t piece_size = (header >> 16) & 0xFF;
+			size_t offset = (header >> 32) & 0xFFFF;
+			size_t chunk_size = header >> 48;
+
+			// Pieces of a chunk are in consecutive slots; drop chunks missing any
+			if (offset == 0) {
+				entry.timestamp = timestamp;
+				entry.type = header & 0xFF;
+				entry.flags = (header >> 8) & 0xFF;
+				entry.bytes.clear();
+				building = true;
+			}
+			else if (!building || offset != entry.bytes.size()) {
+				building = false;
+				continue;
+			}
+
+			const uint8_t* data = (const uint8_t*)words;
+			entry.bytes.insert(entry.bytes.end(), data, data + piece_size);
+			if (entry.bytes.size() == chunk_size) {
+				entries.push_back(entry);
+				building = false;
+			}
+		}
+
+		return entries;
+	}
+
+	FlightDump::FlightDump(const std::string& path)
+		: m_open(false), m_dump_time(0), m_dump_wall_time(0)
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (data.size() < 32 || memcmp(data.data(), FIRMATA_FLIGHT_MAGIC, 8)) return;
+
+		const uint8_t* p = data.data();
+		const uint8_t* end = p + data.size();
+		m_dump_time = getLE(p + 8, 8);
+		m_dump_wall_time = getLE(p + 16, 8);
+		size_t reason_size = (size_t)getLE(p + 24, 4);
+		p += 28;
+		if ((size_t)(end - p) < reason_size + 4) return;
+		m_reason.assign((const char*)p, reason_size);
+		p += reason_size;
+
+		uint32_t count = (uint32_t)getLE(p, 4);
+		p += 4;
+		for (uint32_t i = 0; i < count; i++) {
+			if (end - p < FIRMATA_FLIGHT_ENTRY_LEN) return;
+
+			FlightEntry entry;
+			entry.timestamp = getLE(p, 8);
+			entry.type = p[8];
+			entry.flags = p[9];
+			size_t size = (size_t)getLE(p + 12, 4);
+			p += FIRMATA_FLIGHT_ENTRY_LEN;
+			if ((size_t)(end - p) < size) return;
+
+			entry.bytes.assign(p, p + size);
+			p += size;
+			m_entries.push_back(entry);
+		}
+		m_open = true;
+	}
+
+	bool FlightDump::isOpen()
+	{
+		return m_open;
+	}
+
+	uint64_t FlightDump::dumpTime()
+	{
+		return m_dump_time;
+	}
+
+	uint64_t FlightDump::dumpWallTime()
+	{
+		return m_dump_wall_time;
+	}
+
+	const std::string& FlightDump::reason()
+	{
+		return m_reason;
+	}
+
+	const std::vector<FlightEntry>& FlightDump::entries()
+	{
+		return m_entries;
+	}
+
+}
@@ -0,0 +1,289 @@
+#include "firmgroup.h"
+
+#include <chrono>
+#include <cmath>
+
+namespace firmata {
+
+	SamplingGroup::SamplingGroup(const SamplingGroupConfig& config)
+		: m_config(config), m_queue_head(0), m_queue_size(0), m_frames(0), m_dropped(0), m_running(false)
+	{
+		if (m_config.rate_hz <= 0) m_config.rate_hz = 1;
+		if (!m_config.queue_frames) m_config.queue_frames = 1;
+	}
+
+	SamplingGroup::~SamplingGroup()
+	{
+		stop();
+		for (auto& board : m_boards) {
+			board->board->removeSampleListener(board->listener.get());
+		}
+	}
+
+	size_t SamplingGroup::subscribe(Base* board, uint8_t pin)
+	{
+		// The frame thread sized its buffers for the channels there were at start()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_running) return FIRMATA_GROUP_NO_CHANNEL;
+		}
+
+		size_t index;
+		for (index = 0; index < m_boards.size(); index++) {
+			if (m_boards[index]->board == board) break;
+		}
+
+		if (index == m_boards.size()) {
+			std::unique_ptr<t_group_board> entry(new t_group_board());
+			entry->board = board;
+			entry->listener.reset(new BoardListener(this, index));
+			for (int i = 0; i < 256; i++) entry->channel_of[i] = -1;
+			entry->newest.store(0, std::memory_order_relaxed);
+			entry->samples.store(0, std::memory_order_relaxed);
+			entry->stats = GroupBoardStats();
+			entry->aligned_frames = 0;
+			board->addSampleListener(entry->listener.get());
+			m_boards.push_back(std::move(entry));
+		}
+
+		t_group_board& entry = *m_boards[index];
+		if (entry.channel_of[pin] >= 0) return entry.channel_of[pin];
+
+		std::unique_ptr<t_group_channel> channel(new t_group_channel());
+		channel->board = index;
+		channel->pin = pin;
+		channel->count.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < FIRMATA_GROUP_HISTORY; i++) {
+			channel->timestamps[i].store(0, std::memory_order_relaxed);
+			channel->values[i].store(0, std::memory_order_relaxed);
+		}
+
+		entry.channel_of[pin] = (int16_t)m_channels.size();
+		m_channels.push_back(std::move(channel));
+		return m_channels.size() - 1;
+	}
+
+	size_t SamplingGroup::subscribe(Base* board, AnalogChannel channel)
+	{
+		if (channel.pin == FIRMATA_NO_PIN) return FIRMATA_GROUP_NO_CHANNEL;
+		return subscribe(board, (uint8_t)channel.pin);
+	}
+
+	size_t SamplingGroup::channels()
+	{
+		return m_channels.size();
+	}
+
+	void SamplingGroup::start()
+	{
+		if (m_running) return;
+
+		// Size everything up front; building and queueing frames then doesn't allocate
+		m_history.resize(m_channels.size());
+		m_building.values.resize(m_channels.size());
+		m_building.stale.resize(m_channels.size());
+		m_queue.resize(m_config.queue_frames);
+		for (AlignedFrame& frame : m_queue) {
+			frame.values.resize(m_channels.size());
+			frame.stale.resize(m_channels.size());
+		}
+
+		m_running = true;
+		m_thread = std::thread(&SamplingGroup::frameLoop, this);
+	}
+
+	void SamplingGroup::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_running) return;
+			m_running = false;
+		}
+		m_wake.notify_all();
+		m_frame_ready.notify_all();
+		m_thread.join();
+	}
+
+	bool SamplingGroup::nextFrame(AlignedFrame& frame, uint32_t timeout_ms)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		bool ready = m_frame_ready.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+			[this] { return m_queue_size > 0 || !m_running; });
+		if (!ready || m_queue_size == 0) return false;
+
+		// Swap rather than copy; the queue slot takes the caller's old vectors
+		AlignedFrame& queued = m_queue[m_queue_head];
+		frame.sequence = queued.sequence;
+		frame.timestamp = queued.timestamp;
+		frame.values.swap(queued.values);
+		frame.stale.swap(queued.stale);
+		queued.values.resize(m_channels.size());
+		queued.stale.resize(m_channels.size());
+
+		m_queue_head = (m_queue_head + 1) % m_queue.size();
+		m_queue_size--;
+		return true;
+	}
+
+	GroupStats SamplingGroup::stats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		GroupStats stats;
+		stats.frames = m_frames;
+		stats.dropped_frames = m_dropped;
+		for (auto& board : m_boards) {
+			GroupBoardStats board_stats = board->stats;
+			board_stats.samples = board->samples.load(std::memory_order_relaxed);
+			stats.boards.push_back(board_stats);
+		}
+		return stats;
+	}
+
+	void SamplingGroup::BoardListener::onSample(uint8_t pin, uint32_t value, uint64_t timestamp)
+	{
+		m_group->record(m_board, pin, value, timestamp);
+	}
+
+	void SamplingGroup::record(size_t board, uint8_t pin, uint32_t value, uint64_t timestamp)
+	{
+		t_group_board& entry = *m_boards[board];
+		int16_t index = entry.channel_of[pin];
+		if (index < 0) return;
+
+		t_group_channel& channel = *m_channels[index];
+		uint32_t count = channel.count.load(std::memory_order_relaxed);
+
+		SeqLockWriter writer(entry.lock);
+		channel.timestamps[count % FIRMATA_GROUP_HISTORY].store(timestamp, std::memory_order_relaxed);
+		channel.values[count % FIRMATA_GROUP_HISTORY].store(value, std::memory_order_relaxed);
+		channel.count.store(count + 1, std::memory_order_relaxed);
+		entry.newest.store(timestamp, std::memory_order_relaxed);
+		entry.samples.store(entry.samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void SamplingGroup::frameLoop()
+	{
+		uint64_t period = (uint64_t)(1000000 / m_config.rate_hz);
+		if (!period) period = 1;
+		uint64_t next = monotonicMicros() - m_config.delay_us + period;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_running) {
+			std::chrono::steady_clock::time_point due(std::chrono::microseconds(next + m_config.delay_us));
+			m_wake.wait_until(lock, due, [this] { return !m_running; });
+			if (!m_running) break;
+
+			lock.unlock();
+			buildFrame(next);
+			lock.lock();
+
+			// Copy into the queue, dropping the oldest frame if the consumer fell behind
+			if (m_queue_size == m_queue.size()) {
+				m_queue_head = (m_queue_head + 1) % m_queue.size();
+				m_queue_size--;
+				m_dropped++;
+			}
+			AlignedFrame& slot = m_queue[(m_queue_head + m_queue_size) % m_queue.size()];
+			slot.sequence = m_frames++;
+			slot.timestamp = m_building.timestamp;
+			slot.values.assign(m_building.values.begin(), m_building.values.end());
+			slot.stale.assign(m_building.stale.begin(), m_building.stale.end());
+			m_queue_size++;
+			m_frame_ready.notify_one();
+
+			next += period;
+		}
+	}
+
+	void SamplingGroup::buildFrame(uint64_t timestamp)
+	{
+		uint64_t now = monotonicMicros();
+		m_building.timestamp = timestamp;
+
+		for (size_t board = 0; board < m_boards.size(); board++) {
+			t_group_board& entry = *m_boards[board];
+
+			// Copy the board's histories as of one point in its parse stream
+			uint32_t sequence;
+			uint64_t newest;
+			do {
+				sequence = entry.lock.readBegin();
+				newest = entry.newest.load(std::memory_order_relaxed);
+				for (size_t i = 0; i < m_channels.size(); i++) {
+					t_group_channel& channel = *m_channels[i];
+					if (channel.board != board) continue;
+
+					t_history& history = m_history[i];
+					history.count = channel.count.load(std::memory_order_relaxed);
+					for (int j = 0; j < FIRMATA_GROUP_HISTORY; j++) {
+						history.timestamps[j] = channel.timestamps[j].load(std::memory_order_relaxed);
+						history.values[j] = channel.values[j].load(std::memory_order_relaxed);
+					}
+				}
+			} while (entry.lock.readRetry(sequence));
+
+			uint64_t skew = 0;
+			size_t aligned = 0;
+			bool any_stale = false;
+			for (size_t i = 0; i < m_channels.size(); i++) {
+				if (m_channels[i]->board != board) continue;
+
+				uint64_t sample_time = 0;
+				m_building.values[i] = align(m_history[i], timestamp, sample_time);
+				bool stale = !m_history[i].count || (sample_time < timestamp && timestamp - sample_time > m_config.stale_us);
+				m_building.stale[i] = stale;
+				any_stale |= stale;
+
+				if (m_history[i].count && sample_time < timestamp) skew += timestamp - sample_time;
+				if (m_history[i].count) aligned++;
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			GroupBoardStats& stats = entry.stats;
+			if (aligned) {
+				double mean = (double)skew / aligned;
+				stats.skew_us += (mean - stats.skew_us) / ++entry.aligned_frames;
+				if ((uint64_t)mean > stats.max_skew_us) stats.max_skew_us = (uint64_t)mean;
+			}
+			stats.staleness_us = newest && now > newest ? now - newest : 0;
+			if (stats.staleness_us > stats.max_staleness_us) stats.max_staleness_us = stats.staleness_us;
+			if (any_stale) stats.stale_frames++;
+		}
+	}
+
+	double SamplingGroup::align(const t_history& history, uint64_t timestamp, uint64_t& sample_time)
+	{
+		if (!history.count) return NAN;
+
+		// Walk back from the newest sample to the last one at or before the frame time
+		uint32_t kept = history.count < FIRMATA_GROUP_HISTORY ? history.count : FIRMATA_GROUP_HISTORY;
+		uint32_t before = history.count;
+		for (uint32_t n = 1; n <= kept; n++) {
+			uint32_t slot = (history.count - n) % FIRMATA_GROUP_HISTORY;
+			if (history.timestamps[slot] <= timestamp) {
+				before = history.count - n;
+				break;
+			}
+		}
+
+		// Every sample kept is newer than the frame; the oldest is the best there is
+		if (before == history.count) {
+			uint32_t slot = (history.count - kept) % FIRMATA_GROUP_HISTORY;
+			sample_time = history.timestamps[slot];
+			return history.values[slot];
+		}
+
+		uint32_t slot = before % FIRMATA_GROUP_HISTORY;
+		sample_time = history.timestamps[slot];
+		double value = history.values[slot];
+		if (m_config.mode != ALIGN_INTERPOLATE || before + 1 == history.count) return value;
+
+		uint32_t after = (before + 1) % FIRMATA_GROUP_HISTORY;
+		uint64_t span = history.timestamps[after] - sample_time;
+		if (!span) return history.values[after];
+
+		double fraction = (double)(timestamp - sample_time) / span;
+		return value + fraction * ((double)history.values[after] - value);
+	}
+
+}
@@ -1,131 +1,291 @@
 #include "firmi2c.h"
+#include "firmpack.h"
 
 namespace firmata {
-	I2C::I2C(FirmIO* firmIO) : Base(firmIO) {};
+	I2C::I2C(FirmIO* firmIO) : Base(firmIO), m_delay(0), m_configured(false), m_truncated(0), m_dropped(0)
+	{
+		initSlots();
+	};
+	I2C::I2C(FirmIO* firmIO, const FirmwareIdentity& identity) : Base(firmIO, identity), m_delay(0), m_configured(false), m_truncated(0), m_dropped(0)
+	{
+		initSlots();
+	};
 	I2C::~I2C() {};
 
+	void I2C::initSlots()
+	{
+		for (int i = 0; i < FIRMATA_I2C_MAX_SLOTS; i++) {
+			m_slots[i].key.store(0, std::memory_order_relaxed);
+			m_slots[i].reporting.store(false, std::memory_order_relaxed);
+			m_slots[i].report_bytes = 0;
+			m_slots[i].published = true;
+			m_slots[i].length.store(0, std::memory_order_relaxed);
+			m_slots[i].filtered.store(0, std::memory_order_relaxed);
+		}
+	}
+
 	void I2C::configI2C(uint32_t delay)
 	{
 		m_delay = delay;
-
-		uint8_t lsb = FIRMATA_LSB(delay);
-		uint8_t msb = FIRMATA_MSB(delay);
-
-		sysexCommand({ FIRMATA_I2C_CONFIG, lsb, msb });
+		m_configured = true;
+		sendMessage(i2cConfigMessage(delay));
 	}
 
-	void I2C::reportI2C(uint16_t address, uint16_t reg, uint32_t bytes)
+	bool I2C::reportI2C(uint16_t address, uint16_t reg, uint32_t bytes)
 	{
-		uint8_t address_lsb = FIRMATA_LSB(address);
-		uint8_t address_msb = FIRMATA_MSB(address);
-
-		if (address_msb) {
-			address_msb |= FIRMATA_I2C_10_BIT;
-		}
-
-		if (bytes == 0) {
-			address_msb |= FIRMATA_I2C_STOP_READING;
-			reporting[address][reg] = false;
-		}
-		else {
-			address_msb |= FIRMATA_I2C_READ_CONTINUOUS;		
-			reporting[address][reg] = true;
+		t_i2c_slot* existing = findSlot(address, reg, false);
+		uint32_t reported = existing && existing->reporting.load(std::memory_order_relaxed) ? existing->report_bytes : 0;
+		if (budgetEnabled() && bytes > reported) {
+			ReportConfig proposed = reportConfig();
+			for (auto it = proposed.i2c_reports.begin(); it != proposed.i2c_reports.end(); ++it) {
+				if (it->address == address && it->reg == reg) {
+					proposed.i2c_reports.erase(it);
+					break;
+				}
+			}
+			proposed.i2c_reports.push_back({ address, reg, bytes });
+			if (!admitReports(proposed)) return false;
 		}
 
-		uint8_t bytes_lsb = FIRMATA_LSB(bytes);
-		uint8_t bytes_msb = FIRMATA_MSB(bytes);
+		// Replies with nowhere to go would only be dropped
+		t_i2c_slot* slot = findSlot(address, reg, bytes != 0);
+		if (bytes && !slot) return false;
+		if (slot) slot->report_bytes = bytes;
+		if (slot) slot->reporting.store(bytes != 0, std::memory_order_relaxed);
 
+		uint8_t mode = bytes ? FIRMATA_I2C_READ_CONTINUOUS : FIRMATA_I2C_STOP_READING;
 		if (reg == FIRMATA_I2C_REGISTER_NOT_SPECIFIED) {
-			sysexCommand({ FIRMATA_I2C_REQUEST, address_lsb, address_msb, bytes_lsb, bytes_msb });
+			sendMessage(i2cRequestMessage(address, mode, bytes));
 		}
 		else {
-			uint8_t register_lsb = FIRMATA_LSB(reg);
-			uint8_t register_msb = FIRMATA_MSB(reg);
-
-			sysexCommand({ FIRMATA_I2C_REQUEST, address_lsb, address_msb, register_lsb, register_msb, bytes_lsb, bytes_msb });
+			sendMessage(i2cRequestMessage(address, reg, mode, bytes));
 		}
+		return true;
 	}
 
 	std::vector<uint8_t> I2C::readI2COnce(uint16_t address, uint16_t reg, uint32_t bytes)
 	{
-		uint8_t address_lsb = FIRMATA_LSB(address);
-		uint8_t address_msb = FIRMATA_MSB(address);
-
-		if (address_msb) {
-			address_msb |= FIRMATA_I2C_10_BIT;
-		}
-		address_msb |= FIRMATA_I2C_READ_ONCE;
-
-		uint8_t bytes_lsb = FIRMATA_LSB(bytes);
-		uint8_t bytes_msb = FIRMATA_MSB(bytes);
-
 		if (reg == FIRMATA_I2C_REGISTER_NOT_SPECIFIED) {
-			sysexCommand({ FIRMATA_I2C_REQUEST, address_lsb, address_msb, bytes_lsb, bytes_msb });
+			sendMessage(i2cRequestMessage(address, FIRMATA_I2C_READ_ONCE, bytes));
 		}
 		else {
-			uint8_t register_lsb = FIRMATA_LSB(reg);
-			uint8_t register_msb = FIRMATA_MSB(reg);
-
-			sysexCommand({ FIRMATA_I2C_REQUEST, address_lsb, address_msb, register_lsb, register_msb, bytes_lsb, bytes_msb });
+			sendMessage(i2cRequestMessage(address, reg, FIRMATA_I2C_READ_ONCE, bytes));
 		}
 
 		awaitSysexResponse(FIRMATA_I2C_REPLY); // TODO: Wait for specific reply, not just any reply
 
-		return values[address][reg];
+		uint8_t reply[FIRMATA_I2C_MAX_REPLY];
+		size_t length = copyReply(findSlot(address, reg, false), reply, sizeof(reply));
+		return std::vector<uint8_t>(reply, reply + length);
 	}
 
 	std::vector<uint8_t> I2C::readI2C(uint16_t address, uint16_t reg)
 	{
-		if (reporting[address][reg]) return values[address][reg];
-		return {};
+		uint8_t reply[FIRMATA_I2C_MAX_REPLY];
+		size_t length = readI2C(address, reg, reply, sizeof(reply));
+		return std::vector<uint8_t>(reply, reply + length);
+	}
+
+	size_t I2C::readI2C(uint16_t address, uint16_t reg, uint8_t* buffer, size_t size)
+	{
+		t_i2c_slot* slot = findSlot(address, reg, false);
+		if (!slot || !slot->reporting.load(std::memory_order_relaxed)) return 0;
+		return copyReply(slot, buffer, size);
 	}
 
 	void I2C::writeI2C(uint16_t address, std::vector<uint8_t> data)
 	{
-		uint8_t address_lsb = FIRMATA_LSB(address);
-		uint8_t address_msb = FIRMATA_MSB(address);
+		writeI2C(address, data.data(), data.size());
+	}
+
+	void I2C::writeI2C(uint16_t address, const uint8_t* data, size_t size)
+	{
+		// Reused, so steady-state writes don't allocate
+		if (m_write_buffer.size() < 2 * size + 5) m_write_buffer.resize(2 * size + 5);
+		size_t length = writeI2CWrite(m_write_buffer.data(), address, data, size);
+		sendMessage(m_write_buffer.data(), length);
+	}
 
-		if (address_msb) {
-			address_msb |= FIRMATA_I2C_10_BIT;
+	void I2C::filterI2C(uint16_t address, uint16_t reg, FilterChain* filter, const I2CValue& value)
+	{
+		t_i2c_slot* slot = findSlot(address, reg, true);
+		if (!slot) {
+			delete filter;
+			return;
 		}
-		address_msb |= FIRMATA_I2C_WRITE;
 
-		std::vector<uint8_t> sysex_buffer = { FIRMATA_I2C_REQUEST, address_lsb, address_msb };
+		slot->filter.reset(filter);
+		slot->value = value;
+		if (slot->value.width < 1) slot->value.width = 1;
+		if (slot->value.width > 4) slot->value.width = 4;
+		slot->filtered.store(0, std::memory_order_relaxed);
+	}
 
-		uint8_t lsb;
-		uint8_t msb;
-		for (uint8_t byte : data) {
-			lsb = FIRMATA_LSB(byte);
-			msb = FIRMATA_MSB(byte);
-			sysex_buffer.push_back(lsb);
-			sysex_buffer.push_back(msb);
+	double I2C::readI2CFiltered(uint16_t address, uint16_t reg)
+	{
+		t_i2c_slot* slot = findSlot(address, reg, false);
+		return slot ? slot->filtered.load(std::memory_order_relaxed) : 0;
+	}
+
+	I2CStats I2C::i2cStats()
+	{
+		I2CStats stats;
+		stats.truncated_replies = m_truncated.load(std::memory_order_relaxed);
+		stats.dropped_replies = m_dropped.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	void I2C::describeReports(ReportConfig& config)
+	{
+		for (int i = 0; i < FIRMATA_I2C_MAX_SLOTS; i++) {
+			t_i2c_slot* slot = &m_slots[i];
+			uint32_t key = slot->key.load(std::memory_order_acquire);
+			if (!key || !slot->reporting.load(std::memory_order_relaxed)) continue;
+
+			config.i2c_reports.push_back({ (uint16_t)((key >> 16) & 0x7FFF), (uint16_t)(key & 0xFFFF), slot->report_bytes });
 		}
+	}
+
+	void I2C::publishState(ShmPublisher& publisher, bool full)
+	{
+		for (int i = 0; i < FIRMATA_I2C_MAX_SLOTS; i++) {
+			t_i2c_slot* slot = &m_slots[i];
+			if (slot->published && !full) continue;
+
+			uint32_t key = slot->key.load(std::memory_order_acquire);
+			if (!key) continue;
 
-		sysexCommand(sysex_buffer);
+			uint8_t reply[FIRMATA_I2C_MAX_REPLY];
+			size_t length = copyReply(slot, reply, sizeof(reply));
+			publisher.setI2C(key, reply, length);
+			slot->published = true;
+		}
 	}
 
-	bool I2C::handleSysex(uint8_t command, std::vector<uint8_t> data)
+	bool I2C::handleSysex(uint8_t command, ByteView data)
 	{
 		if (command == FIRMATA_I2C_REPLY) {
-			std::vector<uint8_t> reply_buffer = {};
+			if (data.size() < 4) return true;
 
 			uint16_t address = FIRMATA_COMBINE_LSB_MSB(data[0], data[1]);
 			uint16_t reg = FIRMATA_COMBINE_LSB_MSB(data[2], data[3]);
 
-			for (int i = 4; i + 1 < data.size(); i = i + 2) {
-				uint8_t reply_byte = FIRMATA_COMBINE_LSB_MSB(data[i], data[i + 1]);
-				reply_buffer.push_back(reply_byte);
+			t_i2c_slot* slot = findSlot(address, reg, true);
+			if (!slot) {
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+
+			uint8_t reply[FIRMATA_I2C_MAX_REPLY];
+			size_t pairs_size = data.size() - 4;
+			if (pairs_size > 2 * FIRMATA_I2C_MAX_REPLY) {
+				pairs_size = 2 * FIRMATA_I2C_MAX_REPLY;
+				m_truncated.fetch_add(1, std::memory_order_relaxed);
 			}
+			size_t length = decode7BitPairs(data.data() + 4, pairs_size, reply);
 
-			values[address][reg] = reply_buffer;
+			{
+				SeqLockWriter writer(slot->lock);
+				for (size_t i = 0; i < length; i++) {
+					slot->bytes[i].store(reply[i], std::memory_order_relaxed);
+				}
+				slot->length.store((uint8_t)length, std::memory_order_relaxed);
+			}
+			slot->published = false;
 
+			filterReply(slot, reply, length);
 			return true;
 		}
 		return false;
 	}
 
-	bool I2C::handleString(std::string data)
+	bool I2C::handleString(StringView)
 	{
 		return false;
 	}
+
+	void I2C::reserveBuffers()
+	{
+		// Writes up to the longest reply go out without growing the buffer
+		if (m_write_buffer.size() < 2 * FIRMATA_I2C_MAX_REPLY + 5) m_write_buffer.resize(2 * FIRMATA_I2C_MAX_REPLY + 5);
+	}
+
+	void I2C::replayConfiguration()
+	{
+		if (m_configured) configI2C(m_delay);
+
+		for (int i = 0; i < FIRMATA_I2C_MAX_SLOTS; i++) {
+			t_i2c_slot* slot = &m_slots[i];
+			uint32_t key = slot->key.load(std::memory_order_acquire);
+			if (!key || !slot->reporting.load(std::memory_order_relaxed)) continue;
+
+			reportI2C((key >> 16) & 0x7FFF, key & 0xFFFF, slot->report_bytes);
+		}
+	}
+
+	I2C::t_i2c_slot* I2C::findSlot(uint16_t address, uint16_t reg, bool create)
+	{
+		uint32_t key = 0x80000000 | (address << 16) | reg;
+		uint32_t start = (address * 31 + reg) % FIRMATA_I2C_MAX_SLOTS;
+
+		for (uint32_t probe = 0; probe < FIRMATA_I2C_MAX_SLOTS; probe++) {
+			t_i2c_slot* slot = &m_slots[(start + probe) % FIRMATA_I2C_MAX_SLOTS];
+			uint32_t slot_key = slot->key.load(std::memory_order_acquire);
+
+			if (slot_key == 0) {
+				if (!create) return NULL;
+				if (slot->key.compare_exchange_strong(slot_key, key, std::memory_order_acq_rel)) {
+					return slot;
+				}
+			}
+			if (slot_key == key) return slot;
+		}
+
+		return NULL;
+	}
+
+	void I2C::filterReply(t_i2c_slot* slot, const uint8_t* reply, size_t length)
+	{
+		if (!slot->filter || !slot->reporting.load(std::memory_order_relaxed)) return;
+
+		const I2CValue& format = slot->value;
+		if ((size_t)format.offset + format.width > length) return;
+
+		uint32_t raw = 0;
+		for (uint8_t i = 0; i < format.width; i++) {
+			uint8_t byte = reply[format.offset + (format.big_endian ? i : format.width - 1 - i)];
+			raw = (raw << 8) | byte;
+		}
+
+		double input = raw;
+		if (format.is_signed) {
+			uint32_t bits = 8 * format.width;
+			int64_t value = raw;
+			if (raw & ((uint32_t)1 << (bits - 1))) value -= (int64_t)1 << bits;
+			input = (double)value;
+		}
+
+		double output;
+		if (slot->filter->update(input, output)) {
+			slot->filtered.store(output, std::memory_order_relaxed);
+		}
+	}
+
+	size_t I2C::copyReply(t_i2c_slot* slot, uint8_t* buffer, size_t size)
+	{
+		if (!slot) return 0;
+
+		size_t length;
+		uint32_t sequence;
+		do {
+			sequence = slot->lock.readBegin();
+			length = slot->length.load(std::memory_order_relaxed);
+			if (length > size) length = size;
+			for (size_t i = 0; i < length; i++) {
+				buffer[i] = slot->bytes[i].load(std::memory_order_relaxed);
+			}
+		} while (slot->lock.readRetry(sequence));
+
+		return length;
+	}
 }
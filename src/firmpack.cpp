@@ -0,0 +1,134 @@
+#include "firmpack.h"
+#include "firmata_constants.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIRMATA_PACK_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline unsigned int firstSetBit(unsigned int mask)
+{
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+}
+#else
+static inline unsigned int firstSetBit(unsigned int mask)
+{
+	return __builtin_ctz(mask);
+}
+#endif
+
+namespace firmata {
+
+	size_t encode7BitPairs(const uint8_t* bytes, size_t size, uint8_t* out)
+	{
+		size_t i = 0;
+
+#if defined(__AVX2__)
+		const __m256i lsb_mask_256 = _mm256_set1_epi8(0x7F);
+		const __m256i msb_mask_256 = _mm256_set1_epi8(0x01);
+		for (; i + 32 <= size; i += 32) {
+			__m256i in = _mm256_loadu_si256((const __m256i*)(bytes + i));
+			__m256i lsb = _mm256_and_si256(in, lsb_mask_256);
+			__m256i msb = _mm256_and_si256(_mm256_srli_epi16(in, 7), msb_mask_256);
+			// unpack works within 128-bit lanes, so put the lanes back in order
+			__m256i lo = _mm256_unpacklo_epi8(lsb, msb);
+			__m256i hi = _mm256_unpackhi_epi8(lsb, msb);
+			_mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)(out + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+#endif
+#if defined(FIRMATA_PACK_SSE2)
+		const __m128i lsb_mask = _mm_set1_epi8(0x7F);
+		const __m128i msb_mask = _mm_set1_epi8(0x01);
+		for (; i + 16 <= size; i += 16) {
+			__m128i in = _mm_loadu_si128((const __m128i*)(bytes + i));
+			__m128i lsb = _mm_and_si128(in, lsb_mask);
+			__m128i msb = _mm_and_si128(_mm_srli_epi16(in, 7), msb_mask);
+			_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi8(lsb, msb));
+			_mm_storeu_si128((__m128i*)(out + 2 * i + 16), _mm_unpackhi_epi8(lsb, msb));
+		}
+#endif
+		for (; i < size; i++) {
+			out[2 * i] = FIRMATA_LSB(bytes[i]);
+			out[2 * i + 1] = FIRMATA_MSB(bytes[i]);
+		}
+
+		return 2 * size;
+	}
+
+	size_t decode7BitPairs(const uint8_t* pairs, size_t size, uint8_t* out)
+	{
+		size_t count = size / 2;
+		size_t i = 0;
+
+		// Each pair is one little-endian 16-bit lane: lsb | (msb << 8)
+#if defined(__AVX2__)
+		const __m256i lsb_mask_256 = _mm256_set1_epi16(0x007F);
+		const __m256i msb_mask_256 = _mm256_set1_epi16(0x0080);
+		for (; i + 32 <= count; i += 32) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(pairs + 2 * i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(pairs + 2 * i + 32));
+			a = _mm256_or_si256(_mm256_and_si256(a, lsb_mask_256), _mm256_and_si256(_mm256_srli_epi16(a, 1), msb_mask_256));
+			b = _mm256_or_si256(_mm256_and_si256(b, lsb_mask_256), _mm256_and_si256(_mm256_srli_epi16(b, 1), msb_mask_256));
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+			_mm256_storeu_si256((__m256i*)(out + i), packed);
+		}
+#endif
+#if defined(FIRMATA_PACK_SSE2)
+		const __m128i lsb_mask = _mm_set1_epi16(0x007F);
+		const __m128i msb_mask = _mm_set1_epi16(0x0080);
+		for (; i + 16 <= count; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(pairs + 2 * i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(pairs + 2 * i + 16));
+			a = _mm_or_si128(_mm_and_si128(a, lsb_mask), _mm_and_si128(_mm_srli_epi16(a, 1), msb_mask));
+			b = _mm_or_si128(_mm_and_si128(b, lsb_mask), _mm_and_si128(_mm_srli_epi16(b, 1), msb_mask));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+		}
+#endif
+		for (; i < count; i++) {
+			out[i] = (uint8_t)FIRMATA_COMBINE_LSB_MSB(FIRMATA_LSB(pairs[2 * i]), pairs[2 * i + 1]);
+		}
+
+		return count;
+	}
+
+	const uint8_t* findEndSysex(const uint8_t* begin, const uint8_t* end)
+	{
+		// memchr is already vectorized by every libc we build against
+		const void* found = memchr(begin, FIRMATA_END_SYSEX, end - begin);
+		return found ? (const uint8_t*)found : end;
+	}
+
+	const uint8_t* findStatusByte(const uint8_t* begin, const uint8_t* end)
+	{
+		const uint8_t* p = begin;
+
+#if defined(__AVX2__)
+		for (; p + 32 <= end; p += 32) {
+			unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p));
+			if (mask) return p + firstSetBit(mask);
+		}
+#endif
+#if defined(FIRMATA_PACK_SSE2)
+		for (; p + 16 <= end; p += 16) {
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+			if (mask) return p + firstSetBit(mask);
+		}
+#endif
+		for (; p < end; ++p) {
+			if (*p & 0x80) return p;
+		}
+
+		return end;
+	}
+
+}
@@ -0,0 +1,64 @@
+#include "firmrealtime.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace firmata {
+
+	RealtimeStatus applyRealtime(const RealtimeConfig& config)
+	{
+		RealtimeStatus status;
+		memset(&status, 0, sizeof(status));
+
+#ifdef WIN32
+		if (config.cpu >= 0) {
+			status.pinned = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << config.cpu) != 0;
+			if (!status.pinned && !status.error) status.error = (int)GetLastError();
+		}
+		if (config.priority > 0) {
+			status.scheduled = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+			if (!status.scheduled && !status.error) status.error = (int)GetLastError();
+		}
+#else
+#ifdef __linux__
+		if (config.cpu >= 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(config.cpu, &cpus);
+			int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+			status.pinned = result == 0;
+			if (result && !status.error) status.error = result;
+		}
+#else
+		if (config.cpu >= 0 && !status.error) status.error = ENOTSUP;
+#endif
+		if (config.priority > 0) {
+			struct sched_param param;
+			memset(&param, 0, sizeof(param));
+			param.sched_priority = config.priority;
+			int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+			status.scheduled = result == 0;
+			if (result && !status.error) status.error = result;
+		}
+		if (config.lock_memory) {
+			status.locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+			if (!status.locked && !status.error) status.error = errno;
+
+			// Fault in the stack the I/O thread will use now rather than mid-parse
+			volatile uint8_t stack[FIRMATA_RT_STACK_PREFAULT];
+			for (size_t i = 0; i < sizeof(stack); i += 512) stack[i] = 0;
+		}
+#endif
+
+		return status;
+	}
+
+}
@@ -0,0 +1,521 @@
+#include "firmrecord.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FIRMATA_RECORD_MAGIC		"FIRMREC1"
+#define FIRMATA_RECORD_HEADER_LEN	24
+#define FIRMATA_RECORD_BLOCK_LEN	40
+#define FIRMATA_RECORD_ENTRY_LEN	32
+#define FIRMATA_RECORD_FOOTER_LEN	12
+
+namespace {
+
+	void putLE(std::vector<uint8_t>& out, uint64_t value, int bytes)
+	{
+		for (int i = 0; i < bytes; i++) {
+			out.push_back((uint8_t)(value >> (8 * i)));
+		}
+	}
+
+	uint64_t getLE(const uint8_t* in, int bytes)
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < bytes; i++) {
+			value |= (uint64_t)in[i] << (8 * i);
+		}
+		return value;
+	}
+
+	void putVarint(std::vector<uint8_t>& out, uint64_t value)
+	{
+		while (value >= 0x80) {
+			out.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t)value);
+	}
+
+	bool getVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; in < end && shift < 64; shift += 7) {
+			uint8_t byte = *in++;
+			value |= (uint64_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	uint64_t zigzag(int64_t value)
+	{
+		return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	}
+
+	int64_t unzigzag(uint64_t value)
+	{
+		return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+	}
+
+	void putBlockHeader(std::vector<uint8_t>& out, uint32_t type, uint8_t pin, uint32_t count, uint32_t payload_size,
+		uint64_t first_timestamp, uint64_t last_timestamp, uint32_t first_value, uint32_t timestamp_bytes)
+	{
+		putLE(out, type, 4);
+		putLE(out, pin, 4);
+		putLE(out, count, 4);
+		putLE(out, payload_size, 4);
+		putLE(out, first_timestamp, 8);
+		putLE(out, last_timestamp, 8);
+		putLE(out, first_value, 4);
+		putLE(out, timestamp_bytes, 4);
+	}
+
+}
+
+namespace firmata {
+
+	Recorder::Recorder(const std::string& path, const RecorderConfig& config)
+		: m_config(config), m_file(NULL), m_offset(0), m_filter(false), m_samples(0),
+		m_writing(false), m_stop(false), m_last_index(0)
+	{
+		memset(m_recording, 0, sizeof(m_recording));
+		memset(&m_stats, 0, sizeof(m_stats));
+		if (m_config.max_pending_blocks == 0) m_config.max_pending_blocks = 1;
+		if (m_config.index_interval == 0) m_config.index_interval = 1;
+
+		m_file = fopen(path.c_str(), "wb");
+		if (!m_file) return;
+
+		std::vector<uint8_t> header(FIRMATA_RECORD_MAGIC, FIRMATA_RECORD_MAGIC + 8);
+		putLE(header, monotonicMicros(), 8);
+		putLE(header, std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count(), 8);
+		fwrite(header.data(), 1, header.size(), m_file);
+		m_offset = header.size();
+
+		m_writer = std::thread(&Recorder::writerLoop, this);
+	}
+
+	Recorder::~Recorder()
+	{
+		close();
+	}
+
+	bool Recorder::isOpen()
+	{
+		return m_file != NULL;
+	}
+
+	void Recorder::addPin(uint8_t pin)
+	{
+		m_recording[pin] = true;
+		m_filter = true;
+	}
+
+	void Recorder::onSample(uint8_t pin, uint32_t value, uint64_t timestamp)
+	{
+		if (!m_file || (m_filter && !m_recording[pin])) return;
+
+		t_block* block = openBlock(pin);
+		if (block->count == 0) {
+			block->first_timestamp = timestamp;
+			block->first_value = value;
+		}
+		else {
+			putVarint(block->timestamps, timestamp > block->last_timestamp ? timestamp - block->last_timestamp : 0);
+			putVarint(block->values, zigzag((int64_t)value - (int64_t)block->last_value));
+		}
+		block->last_timestamp = block->count && timestamp < block->last_timestamp ? block->last_timestamp : timestamp;
+		block->last_value = value;
+		block->count++;
+		m_samples.fetch_add(1, std::memory_order_relaxed);
+
+		if (block->count >= m_config.block_samples
+			|| block->last_timestamp - block->first_timestamp >= m_config.block_span_us) {
+			seal(pin, false);
+		}
+	}
+
+	void Recorder::flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_wake.notify_one();
+		m_drained.wait(lock, [this] { return (m_pending.empty() && !m_writing) || !m_writer.joinable(); });
+	}
+
+	void Recorder::close()
+	{
+		if (!m_file) return;
+
+		for (int pin = 0; pin < 256; pin++) {
+			if (m_open[pin] && m_open[pin]->count) seal(pin, true);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_writer.join();
+
+		if (!m_index.empty()) writeIndex();
+
+		std::vector<uint8_t> footer;
+		putLE(footer, FIRMATA_RECORD_FOOTER, 4);
+		putLE(footer, m_last_index, 8);
+		fwrite(footer.data(), 1, footer.size(), m_file);
+
+		fclose(m_file);
+		m_file = NULL;
+		m_drained.notify_all();
+	}
+
+	RecorderStats Recorder::stats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		RecorderStats stats = m_stats;
+		stats.samples = m_samples.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	Recorder::t_block* Recorder::openBlock(uint8_t pin)
+	{
+		if (m_open[pin]) return m_open[pin].get();
+
+		std::unique_ptr<t_block> block;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_free.empty()) {
+				block = std::move(m_free.back());
+				m_free.pop_back();
+			}
+		}
+		if (!block) {
+			block.reset(new t_block());
+			// Worst case is ten bytes per varint; typical deltas take one or two
+			block->timestamps.reserve(2 * m_config.block_samples);
+			block->values.reserve(2 * m_config.block_samples);
+		}
+
+		resetBlock(block.get(), pin);
+		m_open[pin] = std::move(block);
+		return m_open[pin].get();
+	}
+
+	void Recorder::resetBlock(t_block* block, uint8_t pin)
+	{
+		block->pin = pin;
+		block->count = 0;
+		block->first_timestamp = block->last_timestamp = 0;
+		block->first_value = block->last_value = 0;
+		block->timestamps.clear();
+		block->values.clear();
+	}
+
+	void Recorder::seal(uint8_t pin, bool force)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!force && m_pending.size() >= m_config.max_pending_blocks) {
+			// Disk can't keep up; drop this block rather than grow without bound
+			m_stats.dropped_samples += m_open[pin]->count;
+			resetBlock(m_open[pin].get(), pin);
+			return;
+		}
+
+		m_pending.push_back(std::move(m_open[pin]));
+		m_wake.notify_one();
+	}
+
+	void Recorder::writerLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (true) {
+			m_wake.wait_for(lock, std::chrono::milliseconds(m_config.flush_interval_ms),
+				[this] { return !m_pending.empty() || m_stop; });
+
+			while (!m_pending.empty()) {
+				std::unique_ptr<t_block> block = std::move(m_pending.front());
+				m_pending.pop_front();
+				m_writing = true;
+
+				lock.unlock();
+				writeBlock(block.get());
+				lock.lock();
+
+				m_free.push_back(std::move(block));
+				m_writing = false;
+			}
+
+			lock.unlock();
+			fflush(m_file);
+			lock.lock();
+			m_drained.notify_all();
+
+			if (m_stop && m_pending.empty()) break;
+		}
+	}
+
+	void Recorder::writeBlock(t_block* block)
+	{
+		std::vector<uint8_t> header;
+		header.reserve(FIRMATA_RECORD_BLOCK_LEN);
+		putBlockHeader(header, FIRMATA_RECORD_DATA, block->pin, block->count,
+			(uint32_t)(block->timestamps.size() + block->values.size()),
+			block->first_timestamp, block->last_timestamp, block->first_value, (uint32_t)block->timestamps.size());
+
+		fwrite(header.data(), 1, header.size(), m_file);
+		fwrite(block->timestamps.data(), 1, block->timestamps.size(), m_file);
+		fwrite(block->values.data(), 1, block->values.size(), m_file);
+
+		t_index_entry entry = { m_offset, block->first_timestamp, block->last_timestamp, block->count, block->pin };
+		m_index.push_back(entry);
+
+		uint64_t size = header.size() + block->timestamps.size() + block->values.size();
+		m_offset += size;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.blocks_written++;
+			m_stats.bytes_written += size;
+		}
+
+		if (m_index.size() >= m_config.index_interval) writeIndex();
+	}
+
+	void Recorder::writeIndex()
+	{
+		uint64_t first = m_index.front().first_timestamp, last = m_index.front().last_timestamp;
+		for (const t_index_entry& entry : m_index) {
+			first = std::min(first, entry.first_timestamp);
+			last = std::max(last, entry.last_timestamp);
+		}
+
+		std::vector<uint8_t> block;
+		uint32_t payload_size = 8 + FIRMATA_RECORD_ENTRY_LEN * (uint32_t)m_index.size();
+		putBlockHeader(block, FIRMATA_RECORD_INDEX, 0xFF, (uint32_t)m_index.size(), payload_size, first, last, 0, 0);
+		putLE(block, m_last_index, 8);
+		for (const t_index_entry& entry : m_index) {
+			putLE(block, entry.offset, 8);
+			putLE(block, entry.first_timestamp, 8);
+			putLE(block, entry.last_timestamp, 8);
+			putLE(block, entry.count, 4);
+			putLE(block, entry.pin, 4);
+		}
+
+		fwrite(block.data(), 1, block.size(), m_file);
+		m_last_index = m_offset;
+		m_offset += block.size();
+		m_index.clear();
+	}
+
+	RecordingReader::RecordingReader(const std::string& path)
+		: m_data(NULL), m_size(0)
+	{
+#ifndef WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED) {
+				m_data = (const uint8_t*)mapped;
+				m_size = st.st_size;
+			}
+		}
+		::close(fd);
+#else
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file) return;
+		m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		m_data = m_buffer.data();
+		m_size = m_buffer.size();
+#endif
+
+		if (m_size < FIRMATA_RECORD_HEADER_LEN || memcmp(m_data, FIRMATA_RECORD_MAGIC, 8) != 0) {
+#ifndef WIN32
+			if (m_data) munmap((void*)m_data, m_size);
+#endif
+			m_data = NULL;
+			m_size = 0;
+			return;
+		}
+
+		if (!loadIndex()) scanBlocks();
+
+		for (int pin = 0; pin < 256; pin++) {
+			std::sort(m_blocks[pin].begin(), m_blocks[pin].end(),
+				[](const t_block_ref& a, const t_block_ref& b) { return a.first_timestamp < b.first_timestamp; });
+		}
+	}
+
+	RecordingReader::~RecordingReader()
+	{
+#ifndef WIN32
+		if (m_data) munmap((void*)m_data, m_size);
+#endif
+	}
+
+	bool RecordingReader::isOpen()
+	{
+		return m_size > 0;
+	}
+
+	uint64_t RecordingReader::startTime()
+	{
+		return isOpen() ? getLE(m_data + 8, 8) : 0;
+	}
+
+	uint64_t RecordingReader::startWallTime()
+	{
+		return isOpen() ? getLE(m_data + 16, 8) : 0;
+	}
+
+	std::vector<uint8_t> RecordingReader::pins()
+	{
+		std::vector<uint8_t> pins;
+		for (int pin = 0; pin < 256; pin++) {
+			if (!m_blocks[pin].empty()) pins.push_back(pin);
+		}
+		return pins;
+	}
+
+	uint64_t RecordingReader::firstTimestamp(uint8_t pin)
+	{
+		return m_blocks[pin].empty() ? 0 : m_blocks[pin].front().first_timestamp;
+	}
+
+	uint64_t RecordingReader::lastTimestamp(uint8_t pin)
+	{
+		return m_blocks[pin].empty() ? 0 : m_blocks[pin].back().last_timestamp;
+	}
+
+	size_t RecordingReader::read(uint8_t pin, uint64_t begin, uint64_t end, std::vector<RecordedSample>& samples)
+	{
+		const std::vector<t_block_ref>& blocks = m_blocks[pin];
+
+		// Blocks of one pin never overlap in time, so last timestamps are sorted too
+		auto it = std::lower_bound(blocks.begin(), blocks.end(), begin,
+			[](const t_block_ref& block, uint64_t t) { return block.last_timestamp < t; });
+
+		size_t count = 0;
+		for (; it != blocks.end() && it->first_timestamp < end; ++it) {
+			count += decode(*it, begin, end, samples);
+		}
+		return count;
+	}
+
+	bool RecordingReader::valueAt(uint8_t pin, uint64_t timestamp, RecordedSample& sample)
+	{
+		const std::vector<t_block_ref>& blocks = m_blocks[pin];
+
+		auto it = std::upper_bound(blocks.begin(), blocks.end(), timestamp,
+			[](uint64_t t, const t_block_ref& block) { return t < block.first_timestamp; });
+		if (it == blocks.begin()) return false;
+		--it;
+
+		std::vector<RecordedSample> samples;
+		decode(*it, it->first_timestamp, timestamp + 1, samples);
+		if (samples.empty()) return false;
+
+		sample = samples.back();
+		return true;
+	}
+
+	bool RecordingReader::loadIndex()
+	{
+		if (m_size < FIRMATA_RECORD_HEADER_LEN + FIRMATA_RECORD_FOOTER_LEN) return false;
+
+		const uint8_t* footer = m_data + m_size - FIRMATA_RECORD_FOOTER_LEN;
+		if (getLE(footer, 4) != FIRMATA_RECORD_FOOTER) return false;
+
+		uint64_t offset = getLE(footer + 4, 8);
+		while (offset) {
+			if (offset + FIRMATA_RECORD_BLOCK_LEN + 8 > m_size) return false;
+
+			const uint8_t* header = m_data + offset;
+			if (getLE(header, 4) != FIRMATA_RECORD_INDEX) return false;
+
+			uint32_t entries = (uint32_t)getLE(header + 8, 4);
+			if (offset + FIRMATA_RECORD_BLOCK_LEN + 8 + (uint64_t)entries * FIRMATA_RECORD_ENTRY_LEN > m_size) return false;
+
+			const uint8_t* entry = header + FIRMATA_RECORD_BLOCK_LEN + 8;
+			for (uint32_t i = 0; i < entries; i++, entry += FIRMATA_RECORD_ENTRY_LEN) {
+				t_block_ref ref = { getLE(entry, 8), getLE(entry + 8, 8), getLE(entry + 16, 8), (uint32_t)getLE(entry + 24, 4) };
+				addBlock((uint8_t)getLE(entry + 28, 4), ref);
+			}
+
+			offset = getLE(header + FIRMATA_RECORD_BLOCK_LEN, 8);
+		}
+
+		return true;
+	}
+
+	void RecordingReader::scanBlocks()
+	{
+		for (int pin = 0; pin < 256; pin++) m_blocks[pin].clear();
+
+		uint64_t offset = FIRMATA_RECORD_HEADER_LEN;
+		while (offset + FIRMATA_RECORD_BLOCK_LEN <= m_size) {
+			const uint8_t* header = m_data + offset;
+			uint32_t type = (uint32_t)getLE(header, 4);
+			uint64_t payload_size = getLE(header + 12, 4);
+			if (type != FIRMATA_RECORD_DATA && type != FIRMATA_RECORD_INDEX) break;
+			if (offset + FIRMATA_RECORD_BLOCK_LEN + payload_size > m_size) break; // cut short
+
+			if (type == FIRMATA_RECORD_DATA) {
+				t_block_ref ref = { offset, getLE(header + 16, 8), getLE(header + 24, 8), (uint32_t)getLE(header + 8, 4) };
+				addBlock(header[4], ref);
+			}
+			offset += FIRMATA_RECORD_BLOCK_LEN + payload_size;
+		}
+	}
+
+	void RecordingReader::addBlock(uint8_t pin, const t_block_ref& ref)
+	{
+		if (ref.offset + FIRMATA_RECORD_BLOCK_LEN > m_size) return;
+		m_blocks[pin].push_back(ref);
+	}
+
+	size_t RecordingReader::decode(const t_block_ref& ref, uint64_t begin, uint64_t end, std::vector<RecordedSample>& samples)
+	{
+		const uint8_t* header = m_data + ref.offset;
+		uint32_t count = (uint32_t)getLE(header + 8, 4);
+		uint64_t payload_size = getLE(header + 12, 4);
+		uint64_t timestamp_bytes = getLE(header + 36, 4);
+		if (ref.offset + FIRMATA_RECORD_BLOCK_LEN + payload_size > m_size || timestamp_bytes > payload_size) return 0;
+
+		const uint8_t* timestamps = header + FIRMATA_RECORD_BLOCK_LEN;
+		const uint8_t* timestamps_end = timestamps + timestamp_bytes;
+		const uint8_t* values = timestamps_end;
+		const uint8_t* values_end = timestamps + payload_size;
+
+		RecordedSample sample = { getLE(header + 16, 8), (uint32_t)getLE(header + 32, 4) };
+		size_t decoded = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			if (i > 0) {
+				uint64_t delta, zigzagged;
+				if (!getVarint(timestamps, timestamps_end, delta) || !getVarint(values, values_end, zigzagged)) break;
+				sample.timestamp += delta;
+				sample.value = (uint32_t)((int64_t)sample.value + unzigzag(zigzagged));
+			}
+			if (sample.timestamp >= end) break;
+			if (sample.timestamp >= begin) {
+				samples.push_back(sample);
+				decoded++;
+			}
+		}
+		return decoded;
+	}
+
+}
@@ -0,0 +1,90 @@
+#include "firmsampling.h"
+
+namespace firmata {
+
+	SamplingController::SamplingController(Base* board, const SamplingControllerConfig& config)
+		: m_board(board), m_config(config), m_last_update(monotonicMicros()), m_utilization(0)
+	{
+		m_last_stats = m_board->linkStats();
+	}
+
+	bool SamplingController::update()
+	{
+		uint64_t now = monotonicMicros();
+		uint64_t elapsed = now - m_last_update;
+		if (elapsed < (uint64_t)m_config.update_interval_ms * 1000) return false;
+
+		LinkStats stats = m_board->linkStats();
+		uint64_t bytes = stats.bytes_received - m_last_stats.bytes_received;
+		uint64_t malformed = stats.malformed_messages - m_last_stats.malformed_messages;
+		m_last_stats = stats;
+		m_last_update = now;
+
+		double capacity = m_config.baudrate / 10.0 * elapsed / 1000000.0;
+		m_utilization = capacity > 0 ? bytes / capacity : 0;
+		double malformed_rate = bytes ? (double)malformed / bytes : 0;
+
+		// Nothing is reporting, so there's nothing to learn from
+		if (!bytes) return false;
+
+		uint32_t current = m_board->samplingInterval();
+		double target = m_config.target_utilization;
+		double next = current;
+		const char* reason;
+
+		if (malformed_rate > m_config.max_malformed_rate) {
+			next = current * 2.0;
+			reason = "malformed";
+		}
+		else if (m_utilization > target * (1 + m_config.deadband)) {
+			next = current * (m_utilization / target > 2 ? 2 : m_utilization / target);
+			reason = "over target";
+		}
+		else if (m_utilization < target * (1 - m_config.deadband)) {
+			next = current * (m_utilization / target < 0.5 ? 0.5 : m_utilization / target);
+			reason = "under target";
+		}
+		else {
+			return false;
+		}
+
+		if (next < m_config.min_interval_ms) next = m_config.min_interval_ms;
+		if (next > m_config.max_interval_ms) next = m_config.max_interval_ms;
+		uint32_t interval = (uint32_t)(next + 0.5);
+		if (interval == current) return false;
+
+		if (!m_board->setSamplingInterval(interval)) return false;
+		decide(now, malformed_rate, current, interval, reason);
+		return true;
+	}
+
+	uint32_t SamplingController::interval()
+	{
+		return m_board->samplingInterval();
+	}
+
+	double SamplingController::utilization()
+	{
+		return m_utilization;
+	}
+
+	std::vector<SamplingDecision> SamplingController::decisions()
+	{
+		return std::vector<SamplingDecision>(m_decisions.begin(), m_decisions.end());
+	}
+
+	void SamplingController::decide(uint64_t now, double malformed_rate, uint32_t current, uint32_t interval, const char* reason)
+	{
+		SamplingDecision decision;
+		decision.timestamp = now;
+		decision.utilization = m_utilization;
+		decision.malformed_rate = malformed_rate;
+		decision.old_interval_ms = current;
+		decision.new_interval_ms = interval;
+		decision.reason = reason;
+
+		m_decisions.push_back(decision);
+		if (m_decisions.size() > FIRMATA_SAMPLING_DECISIONS) m_decisions.pop_front();
+	}
+
+}
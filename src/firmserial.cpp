@@ -5,11 +5,12 @@
 
 namespace firmata {
 
-	FirmSerial::FirmSerial(const std::string &port, uint32_t baudrate)
+	FirmSerial::FirmSerial(const std::string &port, uint32_t baudrate, uint32_t open_timeout)
 	try : m_serial(port, baudrate, serial::Timeout::simpleTimeout(250)) {
 #ifndef WIN32
+	  if (!open_timeout) return;
 	  serial::Timeout t = m_serial.getTimeout();
-	  t.read_timeout_constant = 5000;
+	  t.read_timeout_constant = open_timeout;
 	  m_serial.setTimeout(t);
 	  m_serial.waitReadable();
 	  int count = m_serial.available();
@@ -20,6 +21,9 @@ namespace firmata {
 	catch (serial::IOException e) {
 	  throw firmata::IOException();
 	}
+	catch (serial::SerialException e) {
+	  throw firmata::IOException();
+	}
 	catch (serial::PortNotOpenedException e) {
 	  throw firmata::NotOpenException();
 	}
@@ -52,7 +56,15 @@ namespace firmata {
 
 	size_t FirmSerial::available()
 	{
-		return m_serial.available();
+		try {
+		  return m_serial.available();
+		} catch (serial::PortNotOpenedException e) {
+		  throw firmata::NotOpenException();
+		} catch (serial::SerialException e) {
+		  throw firmata::IOException();
+		} catch (serial::IOException e) {
+		  throw firmata::IOException();
+		}
 	}
 
 	std::vector<uint8_t> FirmSerial::read(size_t size)
@@ -64,14 +76,34 @@ namespace firmata {
 		  throw firmata::NotOpenException();
 		} catch (serial::SerialException e) {
 		  throw firmata::IOException();
+		} catch (serial::IOException e) {
+		  throw firmata::IOException();
 		}
 		return bytes;
 	}
 
+	size_t FirmSerial::read(uint8_t* buffer, size_t size)
+	{
+		try {
+		  return m_serial.read(buffer, size);
+		} catch (serial::PortNotOpenedException e) {
+		  throw firmata::NotOpenException();
+		} catch (serial::SerialException e) {
+		  throw firmata::IOException();
+		} catch (serial::IOException e) {
+		  throw firmata::IOException();
+		}
+	}
+
 	size_t FirmSerial::write(std::vector<uint8_t> bytes)
+	{
+		return write(bytes.data(), bytes.size());
+	}
+
+	size_t FirmSerial::write(const uint8_t* bytes, size_t size)
 	{
 		try {
-		  return m_serial.write(bytes);
+		  return m_serial.write(bytes, size);
 		} catch (serial::SerialException e) {
 		  throw firmata::IOException();
 		} catch (serial::IOException e) {
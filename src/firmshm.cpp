@@ -0,0 +1,314 @@
+#include "firmshm.h"
+
+#ifndef WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace firmata {
+
+#ifndef WIN32
+	static bool processAlive(uint32_t pid)
+	{
+		return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+	}
+#endif
+
+	ShmPublisher::ShmPublisher(const std::string& name)
+		: m_name(name), m_state(NULL), m_dropped_pins(0)
+	{
+#ifndef WIN32
+		// Another process may have the name already, live or not
+		bool created = true;
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0 && errno == EEXIST) {
+			created = false;
+			fd = shm_open(name.c_str(), O_RDWR, 0);
+		}
+		if (fd < 0) return;
+
+		// An existing segment of another size is still being created, or from another version
+		struct stat info;
+		bool sized = created ? ftruncate(fd, sizeof(SharedState)) == 0
+			: fstat(fd, &info) == 0 && (size_t)info.st_size == sizeof(SharedState);
+		if (sized) {
+			void* mapping = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mapping != MAP_FAILED) m_state = (SharedState*)mapping;
+		}
+		::close(fd);
+		if (!m_state) return;
+
+		// Claim it, unless its publisher is still running
+		uint32_t owner = m_state->publisher_pid.load(std::memory_order_relaxed);
+		if (processAlive(owner) || !m_state->publisher_pid.compare_exchange_strong(owner, (uint32_t)getpid())) {
+			munmap(m_state, sizeof(SharedState));
+			m_state = NULL;
+			return;
+		}
+
+		// A stale segment from a previous run is reused; hide it from clients until reset
+		m_state->magic.store(0, std::memory_order_relaxed);
+		m_state->version = FIRMATA_SHM_VERSION;
+		m_state->sequence.store(m_state->sequence.load(std::memory_order_relaxed) | 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		m_state->updated.store(0, std::memory_order_relaxed);
+		m_state->major_version.store(0, std::memory_order_relaxed);
+		m_state->minor_version.store(0, std::memory_order_relaxed);
+		for (size_t i = 0; i < FIRMATA_SHM_NAME_LEN; i++) m_state->name[i].store(0, std::memory_order_relaxed);
+		m_state->pin_count.store(0, std::memory_order_relaxed);
+		for (size_t i = 0; i < FIRMATA_SHM_PINS; i++) {
+			m_state->modes[i].store(255, std::memory_order_relaxed);
+			m_state->values[i].store(0, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < FIRMATA_SHM_I2C_SLOTS; i++) {
+			m_state->i2c_keys[i].store(0, std::memory_order_relaxed);
+			m_state->i2c_lengths[i].store(0, std::memory_order_relaxed);
+		}
+
+		m_state->sequence.store(m_state->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		m_state->magic.store(FIRMATA_SHM_MAGIC, std::memory_order_release);
+#endif
+	}
+
+	ShmPublisher::~ShmPublisher()
+	{
+#ifndef WIN32
+		if (!m_state) return;
+		m_state->magic.store(0, std::memory_order_release);
+		m_state->publisher_pid.store(0, std::memory_order_release);
+		munmap(m_state, sizeof(SharedState));
+		shm_unlink(m_name.c_str());
+#endif
+	}
+
+	bool ShmPublisher::isOpen()
+	{
+		return m_state != NULL;
+	}
+
+	size_t ShmPublisher::droppedPins()
+	{
+		return m_dropped_pins;
+	}
+
+	void ShmPublisher::begin()
+	{
+		m_state->sequence.store(m_state->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void ShmPublisher::end()
+	{
+		m_state->updated.store(monotonicMicros(), std::memory_order_relaxed);
+		m_state->sequence.store(m_state->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void ShmPublisher::setIdentity(const std::string& name, int major_version, int minor_version)
+	{
+		m_state->major_version.store(major_version, std::memory_order_relaxed);
+		m_state->minor_version.store(minor_version, std::memory_order_relaxed);
+		for (size_t i = 0; i < FIRMATA_SHM_NAME_LEN; i++) {
+			uint8_t c = i < name.size() && i < FIRMATA_SHM_NAME_LEN - 1 ? name[i] : 0;
+			m_state->name[i].store(c, std::memory_order_relaxed);
+		}
+	}
+
+	void ShmPublisher::setPins(size_t count, const t_pin_state* states)
+	{
+		m_dropped_pins = count > FIRMATA_SHM_PINS ? count - FIRMATA_SHM_PINS : 0;
+		if (count > FIRMATA_SHM_PINS) count = FIRMATA_SHM_PINS;
+
+		m_state->pin_count.store((uint32_t)count, std::memory_order_relaxed);
+		for (size_t pin = 0; pin < count; pin++) {
+			m_state->modes[pin].store(states[pin].mode.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			m_state->values[pin].store(states[pin].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+
+	void ShmPublisher::setI2C(uint32_t key, const uint8_t* bytes, size_t size)
+	{
+		if (size > FIRMATA_SHM_I2C_REPLY) size = FIRMATA_SHM_I2C_REPLY;
+
+		for (size_t slot = 0; slot < FIRMATA_SHM_I2C_SLOTS; slot++) {
+			uint32_t slot_key = m_state->i2c_keys[slot].load(std::memory_order_relaxed);
+			if (slot_key != key && slot_key != 0) continue;
+
+			m_state->i2c_keys[slot].store(key, std::memory_order_relaxed);
+			for (size_t i = 0; i < size; i++) {
+				m_state->i2c_bytes[slot][i].store(bytes[i], std::memory_order_relaxed);
+			}
+			m_state->i2c_lengths[slot].store((uint8_t)size, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	ShmClient::ShmClient(const std::string& name)
+		: m_state(NULL), m_stale(false)
+	{
+#ifndef WIN32
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return;
+
+		void* mapping = mmap(NULL, sizeof(SharedState), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED) return;
+
+		m_state = (const SharedState*)mapping;
+		if (m_state->magic.load(std::memory_order_acquire) != FIRMATA_SHM_MAGIC || m_state->version != FIRMATA_SHM_VERSION) {
+			munmap((void*)m_state, sizeof(SharedState));
+			m_state = NULL;
+		}
+#endif
+	}
+
+	ShmClient::~ShmClient()
+	{
+#ifndef WIN32
+		if (m_state) munmap((void*)m_state, sizeof(SharedState));
+#endif
+	}
+
+	bool ShmClient::isOpen()
+	{
+		return m_state != NULL && !m_stale && m_state->magic.load(std::memory_order_acquire) == FIRMATA_SHM_MAGIC;
+	}
+
+	bool ShmClient::stale()
+	{
+		return m_state != NULL && (m_stale || !publisherAlive());
+	}
+
+	uint64_t ShmClient::updated()
+	{
+		return m_state ? m_state->updated.load(std::memory_order_relaxed) : 0;
+	}
+
+	std::string ShmClient::firmwareName()
+	{
+		if (!m_state) return "";
+
+		char name[FIRMATA_SHM_NAME_LEN];
+		uint32_t sequence;
+		do {
+			if (!readBegin(sequence)) return "";
+			for (size_t i = 0; i < FIRMATA_SHM_NAME_LEN; i++) {
+				name[i] = (char)m_state->name[i].load(std::memory_order_relaxed);
+			}
+		} while (readRetry(sequence));
+
+		name[FIRMATA_SHM_NAME_LEN - 1] = 0;
+		return name;
+	}
+
+	int ShmClient::majorVersion()
+	{
+		return m_state ? m_state->major_version.load(std::memory_order_relaxed) : 0;
+	}
+
+	int ShmClient::minorVersion()
+	{
+		return m_state ? m_state->minor_version.load(std::memory_order_relaxed) : 0;
+	}
+
+	size_t ShmClient::pinCount()
+	{
+		return m_state ? m_state->pin_count.load(std::memory_order_relaxed) : 0;
+	}
+
+	uint8_t ShmClient::pinMode(uint8_t pin)
+	{
+		if (!m_state || pin >= FIRMATA_SHM_PINS) return 255;
+		return m_state->modes[pin].load(std::memory_order_relaxed);
+	}
+
+	uint32_t ShmClient::read(uint8_t pin)
+	{
+		if (!m_state || pin >= FIRMATA_SHM_PINS) return 0;
+		return m_state->values[pin].load(std::memory_order_relaxed);
+	}
+
+	void ShmClient::snapshot(Snapshot& snapshot)
+	{
+		uint32_t sequence;
+		do {
+			if (!m_state || !readBegin(sequence)) {
+				snapshot.modes.clear();
+				snapshot.values.clear();
+				return;
+			}
+			size_t count = m_state->pin_count.load(std::memory_order_relaxed);
+			if (count > FIRMATA_SHM_PINS) count = FIRMATA_SHM_PINS;
+
+			snapshot.modes.resize(count);
+			snapshot.values.resize(count);
+			for (size_t pin = 0; pin < count; pin++) {
+				snapshot.modes[pin] = m_state->modes[pin].load(std::memory_order_relaxed);
+				snapshot.values[pin] = m_state->values[pin].load(std::memory_order_relaxed);
+			}
+		} while (readRetry(sequence));
+
+		snapshot.sequence = sequence >> 1;
+	}
+
+	size_t ShmClient::readI2C(uint16_t address, uint16_t reg, uint8_t* buffer, size_t size)
+	{
+		if (!m_state) return 0;
+
+		uint32_t key = 0x80000000 | (address << 16) | reg;
+		size_t length;
+		uint32_t sequence;
+		do {
+			if (!readBegin(sequence)) return 0;
+			length = 0;
+			for (size_t slot = 0; slot < FIRMATA_SHM_I2C_SLOTS; slot++) {
+				if (m_state->i2c_keys[slot].load(std::memory_order_relaxed) != key) continue;
+
+				length = m_state->i2c_lengths[slot].load(std::memory_order_relaxed);
+				if (length > size) length = size;
+				for (size_t i = 0; i < length; i++) {
+					buffer[i] = m_state->i2c_bytes[slot][i].load(std::memory_order_relaxed);
+				}
+				break;
+			}
+		} while (readRetry(sequence));
+
+		return length;
+	}
+
+	bool ShmClient::readBegin(uint32_t& sequence)
+	{
+		uint64_t waiting_since = 0;
+		while ((sequence = m_state->sequence.load(std::memory_order_acquire)) & 1) {
+			uint64_t now = monotonicMicros();
+			if (!waiting_since) waiting_since = now;
+			if (m_stale || now - waiting_since > FIRMATA_SHM_WAIT_US) {
+				// A publisher that died mid-pass never closes it
+				if (!publisherAlive()) m_stale = true;
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	bool ShmClient::readRetry(uint32_t sequence)
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return m_state->sequence.load(std::memory_order_relaxed) != sequence;
+	}
+
+	bool ShmClient::publisherAlive()
+	{
+#ifndef WIN32
+		return processAlive(m_state->publisher_pid.load(std::memory_order_relaxed));
+#else
+		return true;
+#endif
+	}
+
+}
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "firmbudget.h"
+
+/*
+ * Check whether a reporting configuration fits on the serial link before
+ * shipping it. Exits with 1 if it uses more than the headroom (default 80%).
+ *
+ *   firmata_budget <config file> [headroom]
+ *
+ * The config file has one setting per line; # starts a comment:
+ *
+ *   baud 57600
+ *   interval 19               sampling interval in ms
+ *   analog 0 1 2              analog channels reporting
+ *   digital 0 1               digital ports reporting
+ *   digital_changes 10        changes per second per digital port
+ *   i2c 0x48 0 6              continuous read: address, register, bytes
+ *   writes 20                 messages per second sent to the board
+ */
+
+static bool readConfig(std::istream& in, firmata::ReportConfig& config)
+{
+	std::string line;
+	for (int number = 1; std::getline(in, line); number++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		std::string key;
+		if (!(fields >> key)) continue;
+
+		bool ok = true;
+		if (key == "baud") {
+			ok = !!(fields >> config.baudrate);
+		}
+		else if (key == "interval") {
+			ok = !!(fields >> config.sampling_interval_ms);
+		}
+		else if (key == "analog" || key == "digital") {
+			unsigned int value;
+			while (fields >> value) {
+				if (key == "analog") config.analog_channels.push_back((uint8_t)value);
+				else config.digital_ports.push_back((uint8_t)value);
+			}
+			ok = fields.eof();
+		}
+		else if (key == "digital_changes") {
+			ok = !!(fields >> config.digital_changes_per_second);
+		}
+		else if (key == "i2c") {
+			std::string address, reg;
+			uint32_t bytes;
+			ok = !!(fields >> address >> reg >> bytes);
+			if (ok) {
+				config.i2c_reports.push_back({ (uint16_t)strtoul(address.c_str(), NULL, 0),
+					(uint16_t)strtoul(reg.c_str(), NULL, 0), bytes });
+			}
+		}
+		else if (key == "writes") {
+			ok = !!(fields >> config.outbound_messages_per_second);
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok) {
+			std::cerr << "line " << number << ": can't read \"" << line << "\"" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <config file> [headroom]" << std::endl;
+		return 2;
+	}
+	double headroom = argc > 2 ? atof(argv[2]) : 0.8;
+
+	std::ifstream in(argv[1]);
+	if (!in) {
+		std::cerr << "can't open " << argv[1] << std::endl;
+		return 2;
+	}
+
+	firmata::ReportConfig config;
+	if (!readConfig(in, config)) return 2;
+
+	firmata::BandwidthEstimate estimate = firmata::estimateBandwidth(config);
+	std::cout << firmata::describeBandwidth(estimate) << std::endl;
+	std::cout << estimate.setup_bytes << " bytes to enable the reports" << std::endl;
+
+	if (!firmata::withinBudget(estimate, headroom)) {
+		std::cout << "over the " << (int)(100 * headroom) << "% headroom" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "firmata_constants.h"
+#include "firmflight.h"
+
+/*
+ * Print a flight dump written by FlightRecorder: raw bytes read and written,
+ * parsed message headers and events, oldest first, timed relative to the dump.
+ *
+ *   firmata_flight <dump file> [--raw]
+ *
+ * --raw writes only the bytes read from the board to stdout, in order, so
+ * they can be fed back through a parser.
+ */
+
+static void printBytes(const std::vector<uint8_t>& bytes)
+{
+	for (size_t i = 0; i < bytes.size(); i++) {
+		if (i % 16 == 0) printf("\n    ");
+		printf("%02X ", bytes[i]);
+	}
+	printf("\n");
+}
+
+static void printMessage(const firmata::FlightMessage& message)
+{
+	uint8_t nibble = FIRMATA_FIRST_NIBBLE(message.command);
+	if (message.command == 0) {
+		printf("    skipped %u bytes from 0x%02X\n", message.length, message.subcommand);
+	}
+	else if (message.command == FIRMATA_START_SYSEX) {
+		printf("    sysex 0x%02X, %u bytes\n", message.subcommand, message.length);
+	}
+	else if (nibble == FIRMATA_ANALOG_MESSAGE) {
+		printf("    analog %u = %u\n", FIRMATA_LAST_NIBBLE(message.command), message.value);
+	}
+	else if (nibble == FIRMATA_DIGITAL_MESSAGE) {
+		printf("    digital port %u = 0x%02X\n", FIRMATA_LAST_NIBBLE(message.command), message.value);
+	}
+	else if (message.command == FIRMATA_REPORT_VERSION) {
+		printf("    version %u.%u\n", message.value & 0x7F, message.value >> 7);
+	}
+	else {
+		printf("    0x%02X\n", message.command);
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: " << argv[0] << " <dump file> [--raw]" << std::endl;
+		return 1;
+	}
+
+	firmata::FlightDump dump(argv[1]);
+	if (!dump.isOpen()) {
+		std::cerr << "Not a flight dump: " << argv[1] << std::endl;
+		return 1;
+	}
+
+	if (argc > 2 && std::string(argv[2]) == "--raw") {
+		for (const firmata::FlightEntry& entry : dump.entries()) {
+			if (entry.type == firmata::FLIGHT_RX) fwrite(entry.bytes.data(), 1, entry.bytes.size(), stdout);
+		}
+		return 0;
+	}
+
+	printf("reason: %s\n", dump.reason().c_str());
+	printf("entries: %u\n", (unsigned int)dump.entries().size());
+
+	for (const firmata::FlightEntry& entry : dump.entries()) {
+		double ago_ms = ((double)dump.dumpTime() - (double)entry.timestamp) / 1000;
+		const char* truncated = entry.flags & FIRMATA_FLIGHT_TRUNCATED ? " (truncated)" : "";
+
+		switch (entry.type) {
+		case firmata::FLIGHT_RX:
+			printf("-%10.3f ms  rx %u bytes%s", ago_ms, (unsigned int)entry.bytes.size(), truncated);
+			printBytes(entry.bytes);
+			break;
+		case firmata::FLIGHT_TX:
+			printf("-%10.3f ms  tx %u bytes%s", ago_ms, (unsigned int)entry.bytes.size(), truncated);
+			printBytes(entry.bytes);
+			break;
+		case firmata::FLIGHT_MESSAGES:
+			printf("-%10.3f ms  parsed\n", ago_ms);
+			for (const firmata::FlightMessage& message : entry.messages()) printMessage(message);
+			break;
+		case firmata::FLIGHT_EVENT:
+			printf("-%10.3f ms  %s\n", ago_ms, std::string(entry.bytes.begin(), entry.bytes.end()).c_str());
+			break;
+		default:
+			printf("-%10.3f ms  unknown entry type %u\n", ago_ms, entry.type);
+		}
+	}
+	return 0;
+}